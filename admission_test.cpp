@@ -0,0 +1,113 @@
+#include <iostream>
+#include <net.hpp>
+
+// Loopback check of the admission policies: a client flooding the server is paused under throttle and
+// loses the excess under drop. Its control frames are charged too, but never dropped, and the topics
+// it may subscribe to are capped.
+
+constexpr size_t message_count = 60;
+constexpr size_t topic_limit = 16;
+
+struct admission_result {
+    size_t m_handled = 0;
+    uint64_t m_rejected = 0;
+    uint64_t m_throttled = 0;
+    size_t m_subscribers = 0;
+};
+
+/// Send message_count pings and then a subscribe to "alerts", or a_subscribe_flood subscribes to different topics.
+admission_result flood(sr::limit_policy a_policy, sr::port_type a_port, bool a_subscribe_flood = false) {
+    sr::server::net server;
+    server.open(a_port);
+
+    server.add_network_string("Ping");
+
+    sr::admission_policy policy;
+    policy.m_messages = { 100, 10 };
+    policy.m_policy = a_policy;
+    policy.m_max_topics = topic_limit;
+    server.set_admission_policy(policy);
+
+    std::atomic<size_t> handled = 0;
+
+    server.receive("Ping", [&handled](auto& client) {
+        ++handled;
+    });
+
+    server.start_async();
+
+    sr::client::net net;
+    std::promise<void> ready;
+
+    net.on_ready([&ready]() {
+        ready.set_value();
+    });
+
+    net.connect("localhost", a_port);
+    net.start_async();
+    ready.get_future().wait();
+
+    for (size_t i = 0; i < message_count; ++i) {
+        if (a_subscribe_flood) {
+            auto subscribe = net.create_message("NET_SUBSCRIBE");
+            subscribe.write_string("topic " + std::to_string(i));
+            net.queue_send(std::move(subscribe));
+        } else {
+            net.queue_send(net.create_message("Ping"));
+        }
+    }
+
+    if (a_subscribe_flood) {
+        // Paused like any other flood; give it time to be read in full.
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    } else {
+        // Queued behind the pings, so it arrives once the budget is spent; it must not be dropped with them.
+        auto subscribe = net.create_message("NET_SUBSCRIBE");
+        subscribe.write_string("alerts");
+        net.queue_send(std::move(subscribe));
+
+        for (size_t i = 0; i < 300 && handled < message_count; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+
+    net.stop_async();
+    server.stop_async();
+
+    size_t subscribers = server.subscriber_count("alerts");
+
+    if (a_subscribe_flood) {
+        subscribers = 0;
+
+        for (size_t i = 0; i < message_count; ++i) {
+            subscribers += server.subscriber_count("topic " + std::to_string(i));
+        }
+    }
+
+    return { handled, server.get_rejected_count(), server.get_throttled_count(), subscribers };
+}
+
+int main() {
+    auto throttled = flood(sr::limit_policy::throttle, 2020);
+    std::cout << "throttle: handled " << throttled.m_handled << ", rejected " << throttled.m_rejected
+              << ", pauses " << throttled.m_throttled << ", subscribers " << throttled.m_subscribers << std::endl;
+
+    auto dropped = flood(sr::limit_policy::drop, 2021);
+    std::cout << "drop: handled " << dropped.m_handled << ", rejected " << dropped.m_rejected
+              << ", pauses " << dropped.m_throttled << ", subscribers " << dropped.m_subscribers << std::endl;
+
+    auto topics = flood(sr::limit_policy::drop, 2028, true);
+    std::cout << "topics: rejected " << topics.m_rejected << ", pauses " << topics.m_throttled
+              << ", subscriptions " << topics.m_subscribers << std::endl;
+
+    // The subscribe sent over budget is kept, at the cost of a pause; a flood of them is paused the same way.
+    bool passed = throttled.m_handled == message_count && throttled.m_rejected == 0 && throttled.m_throttled > 0 && throttled.m_subscribers == 1
+               && dropped.m_handled < message_count && dropped.m_handled + dropped.m_rejected == message_count
+               && dropped.m_throttled > 0 && dropped.m_subscribers == 1
+               && topics.m_subscribers == topic_limit && topics.m_rejected == message_count - topic_limit && topics.m_throttled > 0;
+    std::cout << (passed ? "passed" : "FAILED") << std::endl;
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,92 @@
+#include <iostream>
+#include <net.hpp>
+
+// Loopback ping-pong between a server and a client in one process. Build once with and once without
+// SR_NET_IO_URING to compare the two backends, or pass an endpoint such as shm:///tmp/sr-bench.sock
+// to compare transports.
+
+constexpr size_t round_trips = 10000;
+constexpr size_t burst_size = 100000;
+constexpr size_t window_size = 1000;
+
+int main(int argc, char** argv) {
+    std::string target = argc > 1 ? argv[1] : "tcp://127.0.0.1:2016";
+
+    sr::server::net server;
+    server.set_registered_receive_buffers(16);
+    server.open(target);
+
+    server.add_network_string("BenchPing");
+    server.add_network_string("BenchPong");
+
+    server.receive("BenchPing", [&server](auto& cl) {
+        auto sequence = server.read_int();
+
+        server.start("BenchPong");
+        server.write_int(sequence);
+        server.send(cl);
+    });
+
+    server.start_async();
+
+    sr::client::net client;
+    std::promise<void> ready;
+    std::promise<void> done;
+    size_t received = 0;
+    size_t expected = round_trips;
+
+    client.on_ready([&ready]() {
+        ready.set_value();
+    });
+
+    client.receive("BenchPong", [&]() {
+        auto sequence = client.read_int();
+
+        if (++received == expected) {
+            received = 0;
+            done.set_value();
+        } else if (expected == round_trips) {
+            client.start("BenchPing");
+            client.write_int(sequence + 1);
+            client.send();
+        }
+    });
+
+    client.connect(target);
+    client.start_async();
+    ready.get_future().wait();
+
+    // Latency: one message in flight at a time.
+    auto start = std::chrono::steady_clock::now();
+
+    auto first = client.create_message("BenchPing");
+    first.write_int(0);
+    client.queue_send(std::move(first));
+    done.get_future().wait();
+
+    auto elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start);
+    std::cout << "round trip: " << elapsed.count() / round_trips << " us" << std::endl;
+
+    // Throughput: queue windows of pings from this thread and let the io thread flush them in batches.
+    // Sends are blocking, so a window has to fit in the socket buffers of both sides.
+    expected = window_size;
+    start = std::chrono::steady_clock::now();
+
+    for (size_t sent = 0; sent < burst_size; sent += window_size) {
+        done = std::promise<void>();
+
+        for (size_t i = 0; i < window_size; ++i) {
+            auto ping = client.create_message("BenchPing");
+            ping.write_int(sent + i);
+            client.queue_send(std::move(ping));
+        }
+
+        done.get_future().wait();
+    }
+
+    elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start);
+    std::cout << "throughput: " << burst_size / (elapsed.count() / 1e6) << " messages/s" << std::endl;
+
+    client.stop_async();
+    server.stop_async();
+}
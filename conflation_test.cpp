@@ -0,0 +1,79 @@
+#include <iostream>
+#include <net.hpp>
+
+// Loopback check that conflated updates collapse to the newest value per key while ordinary sends made
+// alongside them still arrive complete and in order.
+
+constexpr size_t update_count = 20000;
+constexpr size_t key_count = 10;
+
+int main() {
+    sr::server::net server;
+    server.open(2022);
+
+    server.add_network_string("Price");
+    server.add_network_string("Trade");
+
+    server.on_ready([&server](auto& client) {
+        for (size_t i = 0; i < update_count; ++i) {
+            server.start("Price");
+            server.write_int(i % key_count);
+            server.write_int(i);
+            server.send_latest(client, i % key_count);
+
+            server.start("Trade");
+            server.write_int(i);
+            server.send(client);
+        }
+    });
+
+    server.start_async();
+
+    sr::client::net net;
+    std::vector<size_t> latest(key_count);
+    std::atomic<size_t> prices = 0;
+    std::atomic<size_t> trades = 0;
+    std::atomic<size_t> out_of_order = 0;
+
+    net.receive("Price", [&]() {
+        auto key = net.read_int();
+        latest[key] = net.read_int();
+        ++prices;
+    });
+
+    net.receive("Trade", [&]() {
+        if (net.read_int() != trades) {
+            ++out_of_order;
+        }
+
+        ++trades;
+    });
+
+    net.connect("localhost", 2022);
+    net.start_async();
+
+    for (size_t i = 0; i < 500 && trades < update_count; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    net.stop_async();
+    server.stop_async();
+
+    size_t stale = 0;
+
+    for (size_t key = 0; key < key_count; ++key) {
+        if (latest[key] != update_count - key_count + key) {
+            ++stale;
+        }
+    }
+
+    std::cout << "prices " << prices << " of " << update_count << ", stale keys " << stale
+              << ", trades " << trades << ", out of order " << out_of_order << std::endl;
+
+    bool passed = prices < update_count && stale == 0 && trades == update_count && out_of_order == 0;
+    std::cout << (passed ? "passed" : "FAILED") << std::endl;
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,164 @@
+#include <iostream>
+#include <net.hpp>
+
+// Loopback check that co_send() shares each side's write lane with the plain send() calls made while it is
+// suspended, so frames never interleave and every stream of messages arrives complete and in order.
+
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+
+using sr::awaitable;
+
+constexpr size_t blob_count = 2000;
+constexpr size_t blob_size = 3000;
+
+/// Bytes of blob number a_index, so the receiver can tell a torn frame from an intact one.
+std::vector<uint8_t> make_blob(size_t a_index) {
+    std::vector<uint8_t> blob(blob_size);
+
+    for (size_t i = 0; i < blob_size; ++i) {
+        blob[i] = static_cast<uint8_t>(a_index + i);
+    }
+
+    return blob;
+}
+
+/// Tallies for one direction of the test.
+struct tally {
+    std::atomic<size_t> blobs = 0;
+    std::atomic<size_t> ticks = 0;
+    std::atomic<size_t> errors = 0;
+
+    void receive_blob(sr::message& a_message) {
+        if (a_message.read_int() != blobs || a_message.read_bytes() != make_blob(blobs)) {
+            ++errors;
+        }
+
+        ++blobs;
+    }
+
+    void receive_tick(size_t a_tick) {
+        if (a_tick != ticks) {
+            ++errors;
+        }
+
+        ++ticks;
+    }
+};
+
+/// Send blobs with co_send() while a second coroutine sends ticks with send() in between.
+template <typename t_net, typename t_send>
+awaitable<void> send_blobs(t_net& a_net, t_send a_send) {
+    for (size_t i = 0; i < blob_count; ++i) {
+        auto blob = a_net.create_message("Blob");
+        blob.set_buffer_size(blob_size + 64);
+        blob.write_int(i);
+        blob.write_bytes(make_blob(i));
+
+        co_await a_send(std::move(blob));
+    }
+}
+
+template <typename t_send>
+awaitable<void> send_ticks(t_send a_send) {
+    auto executor = co_await boost::asio::this_coro::executor;
+
+    for (size_t i = 0; i < blob_count; ++i) {
+        a_send(i);
+        co_await boost::asio::post(executor, boost::asio::use_awaitable);
+    }
+}
+
+awaitable<void> serve(sr::server::net& a_server) {
+    auto accepted = co_await a_server.co_accept();
+
+    // The server keeps the client until it disconnects, after both senders are done with it.
+    auto* client = accepted.get();
+
+    a_server.spawn(send_ticks([&a_server, client](size_t a_tick) {
+        auto tick = a_server.create_message("Tick");
+        tick.write_int(a_tick);
+        a_server.send(*client, tick);
+    }));
+
+    co_await send_blobs(a_server, [client](sr::message a_message) {
+        return client->co_send(std::move(a_message));
+    });
+}
+
+awaitable<void> talk(sr::client::net& a_net) {
+    co_await a_net.co_connect("localhost", 2029);
+
+    a_net.spawn(send_ticks([&a_net](size_t a_tick) {
+        auto tick = a_net.create_message("Tick");
+        tick.write_int(a_tick);
+        a_net.send(tick);
+    }));
+
+    co_await send_blobs(a_net, [&a_net](sr::message a_message) {
+        return a_net.co_send(std::move(a_message));
+    });
+}
+
+int main() {
+    sr::server::net server;
+    server.open(2029);
+
+    server.add_network_string("Blob");
+    server.add_network_string("Tick");
+
+    tally at_server;
+
+    server.receive("Blob", [&](auto&) {
+        at_server.receive_blob(server);
+    });
+
+    server.receive("Tick", [&](auto&) {
+        at_server.receive_tick(server.read_int());
+    });
+
+    server.spawn(serve(server));
+
+    server.start_async();
+
+    sr::client::net net;
+    tally at_client;
+
+    net.receive("Blob", [&]() {
+        at_client.receive_blob(net);
+    });
+
+    net.receive("Tick", [&]() {
+        at_client.receive_tick(net.read_int());
+    });
+
+    net.spawn(talk(net));
+
+    net.start_async();
+
+    for (size_t i = 0; i < 500 && (at_client.ticks < blob_count || at_client.blobs < blob_count ||
+                                   at_server.ticks < blob_count || at_server.blobs < blob_count); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+
+    net.stop_async();
+    server.stop_async();
+
+    std::cout << "client got " << at_client.blobs << " blobs, " << at_client.ticks << " ticks, " << at_client.errors << " errors; "
+              << "server got " << at_server.blobs << " blobs, " << at_server.ticks << " ticks, " << at_server.errors << " errors"
+              << std::endl;
+
+    bool passed = at_client.blobs == blob_count && at_client.ticks == blob_count && at_client.errors == 0 &&
+                  at_server.blobs == blob_count && at_server.ticks == blob_count && at_server.errors == 0;
+    std::cout << (passed ? "passed" : "FAILED") << std::endl;
+
+    return passed ? 0 : 1;
+}
+
+#else
+
+int main() {
+    std::cout << "skipped: coroutines are not available" << std::endl;
+    return 0;
+}
+
+#endif
@@ -11,8 +11,32 @@
 #include <unordered_map>
 #include <iostream>
 #include <variant>
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <deque>
+#include <future>
+#include <chrono>
+#include <type_traits>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <cstring>
+
+// SR_NET_IO_URING needs Asio's io_uring backend (Boost 1.78 or later, and liburing). The build defines
+// BOOST_ASIO_HAS_IO_URING and BOOST_ASIO_DISABLE_EPOLL along with it, so every translation unit agrees on
+// the backend.
 
 #include <boost/asio.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/shared_memory_object.hpp>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#endif
 
 /// Generate listener/dispatcher for events.
 #define SR_DISPATCHER(listener, ...)   struct listener##_dispatcher {                                                 \
@@ -41,6 +65,12 @@ namespace sr {
     using error_code = boost::system::error_code;
     using port_type = boost::asio::ip::port_type;
     using resolver = boost::asio::ip::tcp::resolver;
+    using frame_size = uint32_t;
+
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+    template <typename t_type>
+    using awaitable = boost::asio::awaitable<t_type>;
+#endif
 
     /// Get the current system time in nanoseconds.
     [[nodiscard]] std::uint64_t system_nano_time() {
@@ -69,91 +99,48 @@ namespace sr {
         virtual void deserialize(void* a_data, size_t a_size) = 0;
     };
 
-    namespace client { class net; }
-    namespace server { class net; }
-
-    template <typename... t_dispatch_args>
-    class net_interface {
-        friend client::net;
-        friend server::net;
-
+    /// Buffer with a read/write cursor for the typed message encoding.
+    class message {
+    protected:
         std::vector<uint8_t> m_buffer;
         size_t m_buffer_index = 0;
 
-        std::vector<std::unique_ptr<std::string>> m_message_ids;
-        std::unordered_map<std::string_view, size_t> m_message_id_map;
-        std::map<std::string_view, std::function<void (t_dispatch_args&&...)>> m_message_handlers;
-        std::unordered_map<size_t, std::function<void (t_dispatch_args&&...)>*> m_message_handlers_id_map;
-        std::vector<std::string_view> m_no_send_ids;
-
     public:
         using integer = size_t;
         using floating = double;
         using boolean = bool;
 
-        void clear_message_ids() {
-            m_message_ids.clear();
-            m_message_id_map.clear();
-            m_message_handlers_id_map.clear();
-            m_no_send_ids.clear();
-        }
+        message() = default;
 
-        auto& get_buffer() {
-            return m_buffer;
-        }
+        explicit message(size_t a_size) : m_buffer(a_size) {}
 
-        void set_buffer_size(size_t a_size) {
-            m_buffer.resize(a_size);
+        /// Start a standalone message with the given numeric message ID.
+        message(size_t a_size, size_t a_id) : m_buffer(a_size) {
+            write_to_buffer(a_id);
         }
 
-        void add_network_string(std::string a_string, bool a_no_send = false) {
-            m_message_ids.emplace_back(std::make_unique<std::string>(std::move(a_string)));
-            std::string_view str = *m_message_ids.back();
-            m_message_id_map[str] = m_message_ids.size();
-
-            if (a_no_send) {
-                m_no_send_ids.push_back(str);
-            }
-        }
+        /// Copy a received message so it can be read independently of the network buffer.
+        message(const uint8_t* a_data, size_t a_size) : m_buffer(a_data, a_data + a_size) {}
 
-        [[nodiscard]] size_t network_string_to_id(std::string_view a_string) {
-            return m_message_id_map[a_string];
+        auto& get_buffer() {
+            return m_buffer;
         }
 
-        [[nodiscard]] std::string_view id_to_network_string(size_t a_string) {
-            auto it = std::find_if(m_message_id_map.begin(), m_message_id_map.end(), [a_string](auto& entry) {
-                return entry.second == a_string;
-            });
-
-            return it->second;
+        [[nodiscard]] const auto& get_buffer() const {
+            return m_buffer;
         }
 
-        void receive(std::string_view a_id, std::function<void (t_dispatch_args&&...)> a_callback) {
-            auto handler_it = m_message_handlers.emplace(a_id, std::move(a_callback));
-
-            auto it = m_message_id_map.find(a_id);
-
-            if (it == m_message_id_map.cend()) {
-                return;
-            }
-
-            m_message_handlers_id_map.emplace(it->second, &handler_it.first->second);
+        void set_buffer_size(size_t a_size) {
+            m_buffer.resize(a_size);
         }
 
-        void start(std::string_view a_id) {
-            auto id_it = m_message_id_map.find(a_id);
-
-            if (id_it == m_message_id_map.cend()) {
-                return;
-            }
-
-            m_buffer_index = 0;
-
-            write_to_buffer(id_it->second);
+        /// Size of the encoded message, i.e. the current write position. This is what gets sent.
+        [[nodiscard]] size_t get_size() const noexcept {
+            return m_buffer_index;
         }
 
         [[nodiscard]] bool is_space_available(size_t a_size) const noexcept {
-            return a_size + m_buffer_index < m_buffer.size();
+            return a_size + m_buffer_index <= m_buffer.size();
         }
 
         template <typename t_type>
@@ -423,36 +410,64 @@ namespace sr {
             return is_next(type::serializable);
         }
 
-        /// Compile a schema message in the buffer containing all of the message IDs.
-        void compile_schema() {
-            start("NET_MESSAGE_SCHEMA");
-            write_int(m_message_id_map.size() - m_no_send_ids.size());
+        // VALUES
+
+        /// Write a value with the writer matching its type.
+        template <typename t_value>
+        void write_value(const t_value& a_value) {
+            if constexpr (std::is_same_v<t_value, boolean>) {
+                write_bool(a_value);
+            } else if constexpr (std::is_integral_v<t_value> || std::is_enum_v<t_value>) {
+                write_int(static_cast<integer>(a_value));
+            } else if constexpr (std::is_floating_point_v<t_value>) {
+                write_float(a_value);
+            } else if constexpr (std::is_convertible_v<const t_value&, std::string_view>) {
+                write_string(a_value);
+            } else if constexpr (std::is_base_of_v<serializable, t_value>) {
+                write(a_value);
+            } else {
+                write_bytes(a_value);
+            }
+        }
 
-            std::cout << (m_message_id_map.size() - m_no_send_ids.size()) << std::endl;
+        template <typename... t_values>
+        void write_values(const t_values&... a_values) {
+            (write_value(a_values), ...);
+        }
 
-            for (auto& entry : m_message_id_map) {
-                if (std::find(m_no_send_ids.begin(), m_no_send_ids.end(), entry.first) != m_no_send_ids.cend()) {
-                    continue;
-                }
+        // CALL ID
 
-                std::cout << entry.first << ' ' << entry.second << std::endl;
+        /// Write the correlation ID that pairs an RPC request with its response.
+        void write_call_id(uint32_t a_id) {
+            write_to_buffer(a_id);
+        }
 
-                write_string(entry.first);
-                write_int(entry.second);
-            }
+        uint32_t read_call_id() {
+            return read_from_buffer<uint32_t>();
         }
 
-        void dispatch(t_dispatch_args&&... a_args) {
+        void reset_buffer_position() {
             m_buffer_index = 0;
-            auto key = read_from_buffer<size_t>();
-            (*m_message_handlers_id_map[key])(std::forward<t_dispatch_args>(a_args)...);
         }
 
-        void reset_buffer_position() {
+        /// Rewind to the start of the message and read its message ID.
+        size_t read_id() {
             m_buffer_index = 0;
+            return read_from_buffer<size_t>();
         }
 
-    private:
+        /// Get the message ID without moving the read position.
+        [[nodiscard]] size_t peek_id() const {
+            if (m_buffer.size() < sizeof(size_t)) {
+                throw std::out_of_range("overflowed buffer storage");
+            }
+
+            size_t id;
+            std::memcpy(&id, m_buffer.data(), sizeof(id));
+            return id;
+        }
+
+    protected:
         void check_next_type(type a_type) {
             if (read_from_buffer<type>() != a_type) {
                 throw std::invalid_argument("type of next element does not match requested type");
@@ -480,7 +495,7 @@ namespace sr {
 
         template <typename t_type>
         void write_to_buffer(const t_type* a_data, size_t a_size) {
-            if (!is_space_available<t_type>()) {
+            if (!is_space_available(a_size)) {
                 throw std::out_of_range("overflowed buffer storage");
             }
 
@@ -515,7 +530,7 @@ namespace sr {
 
         template <typename t_type>
         void read_from_buffer(t_type* a_data, size_t a_size) {
-            if (!is_space_available<t_type>()) {
+            if (!is_space_available(a_size)) {
                 throw std::out_of_range("overflowed buffer storage");
             }
 
@@ -526,7 +541,7 @@ namespace sr {
 
         template <typename t_type>
         void peek_from_buffer(t_type* a_data, size_t a_size) const {
-            if (!is_space_available<t_type>()) {
+            if (!is_space_available(a_size)) {
                 throw std::out_of_range("overflowed buffer storage");
             }
 
@@ -548,276 +563,3540 @@ namespace sr {
         }
     };
 
-    namespace client {
-        SR_DISPATCHER(connect);
-        SR_DISPATCHER(disconnect);
-        SR_DISPATCHER(message);
-        SR_DISPATCHER(ready);
+    /// Lock-free multi-producer single-consumer queue (Vyukov intrusive queue).
+    template <typename t_type>
+    class mpsc_queue {
+        struct node {
+            std::atomic<node*> m_next = nullptr;
+            t_type m_value;
+        };
 
-        class net :
-            public net_interface<>,
-            public connect_dispatcher,
-            public disconnect_dispatcher,
-            public message_dispatcher,
-            public ready_dispatcher
-        {
-            io_context m_context;
-            resolver m_resolver;
-            socket m_socket;
-            bool m_connected = false;
+        std::atomic<node*> m_head; ///< Most recently pushed node; producers swap themselves in here.
+        node* m_tail;              ///< Consumed stub node. Its successor holds the oldest value.
 
-            std::thread m_thread;
-            bool m_running = false;
+    public:
+        mpsc_queue() : m_head(new node()), m_tail(m_head.load()) {}
 
-        public:
-            explicit net() : m_context(), m_resolver(m_context), m_socket(m_context) {
-                set_buffer_size(8192);
+        mpsc_queue(const mpsc_queue&) = delete;
+        mpsc_queue& operator = (const mpsc_queue&) = delete;
+
+        ~mpsc_queue() {
+            t_type value;
+            while (pop(value)) {}
+            delete m_tail;
+        }
 
-                add_network_string("NET_MESSAGE_SCHEMA", true);
-                add_network_string("NET_SIGNAL_READY", true);
+        /// Push a value. Safe to call from any thread.
+        void push(t_type a_value) {
+            auto* n = new node();
+            n->m_value = std::move(a_value);
 
-                receive("NET_MESSAGE_SCHEMA", [this]() {
-                    clear_message_ids();
+            node* prev = m_head.exchange(n, std::memory_order_acq_rel);
+            prev->m_next.store(n, std::memory_order_release);
+        }
 
-                    add_network_string("NET_MESSAGE_SCHEMA", true);
-                    add_network_string("NET_SIGNAL_READY", true);
+        /// Pop the oldest value. Must only be called from the consuming thread.
+        bool pop(t_type& a_value) {
+            node* next = m_tail->m_next.load(std::memory_order_acquire);
 
-                    size_t count = read_int();
+            if (next == nullptr) {
+                return false;
+            }
 
-                    while (count--) {
-                        m_message_ids.push_back(std::make_unique<std::string>(read_string()));
-                        std::string_view str = *m_message_ids.back();
+            a_value = std::move(next->m_value);
 
-                        size_t id = read_int();
+            delete m_tail;
+            m_tail = next;
 
-                        m_message_id_map.emplace(str, id);
+            return true;
+        }
+    };
 
-                        auto handler_it = m_message_handlers.find(str);
+    /// Thread pool that runs offloaded message handlers away from the io thread.
+    class worker_pool {
+        boost::asio::thread_pool m_pool;
 
-                        if (handler_it != m_message_handlers.cend()) {
-                            m_message_handlers_id_map.emplace(id, &handler_it->second);
-                        }
-                    }
+    public:
+        /// Executor that runs its tasks one at a time, in the order they were posted.
+        using serial_queue = boost::asio::strand<boost::asio::thread_pool::executor_type>;
 
-                    dispatch_ready();
+        explicit worker_pool(size_t a_threads) : m_pool(a_threads) {}
 
-                    start("NET_SIGNAL_READY");
-                    send();
-                });
-            }
+        [[nodiscard]] serial_queue make_serial_queue() {
+            return boost::asio::make_strand(m_pool.get_executor());
+        }
 
-            void connect(const std::string& a_hostname, port_type a_port) {
-                error_code ec;
-                boost::asio::connect(m_socket, m_resolver.resolve(a_hostname, std::to_string(a_port)), ec);
-                dispatch_connect();
+        /// Wait for every posted task to finish.
+        void join() {
+            m_pool.join();
+        }
+    };
 
-                begin_accept_message();
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+    /// Queue that coroutines on the io thread can wait on. Not thread-safe.
+    template <typename t_type>
+    class awaitable_queue {
+        std::deque<t_type> m_values;
+        std::optional<boost::asio::steady_timer> m_signal; ///< Never expires; cancelled to wake a waiting coroutine.
+        bool m_closed = false;
 
-                m_connected = true;
-            }
+    public:
+        void push(t_type a_value) {
+            m_values.push_back(std::move(a_value));
 
-            void start_async() {
-                m_running = true;
-                m_thread = std::thread(&net::run, this);
+            if (m_signal) {
+                m_signal->cancel_one();
             }
+        }
 
-            void stop_async() {
-                m_running = false;
-                m_thread.join();
-            }
+        /// Wake all waiting coroutines. Once the remaining values are taken, pop() throws.
+        void close() {
+            m_closed = true;
 
-            void start_sync() {
-                m_running = true;
-                run();
+            if (m_signal) {
+                m_signal->cancel();
             }
+        }
 
-            void send() {
-                boost::asio::write(m_socket, boost::asio::buffer(get_buffer()));
+        /// Accept values again after close(), for example on a new connection.
+        void reopen() {
+            m_closed = false;
+        }
+
+        /// Drop the values nobody took.
+        void clear() {
+            m_values.clear();
+        }
+
+        awaitable<t_type> pop() {
+            if (!m_signal) {
+                m_signal.emplace(co_await boost::asio::this_coro::executor, boost::asio::steady_timer::time_point::max());
             }
 
-        private:
-            void begin_accept_message() {
-                m_socket.async_read_some(
-                        boost::asio::buffer(get_buffer()),
-                        [this](boost::system::error_code a_ec, std::size_t a_bytes_transferred) {
-                            std::cout << a_bytes_transferred << " transferred." << std::endl;
+            while (m_values.empty()) {
+                if (m_closed) {
+                    throw boost::system::system_error(boost::asio::error::not_connected);
+                }
 
-                            if (a_ec == boost::asio::error::connection_reset) {
-                                // Detected client disconnect.
+                error_code ec;
+                co_await m_signal->async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+            }
 
-                                m_connected = false;
-                                dispatch_disconnect();
-                                return;
-                            }
+            t_type value = std::move(m_values.front());
+            m_values.pop_front();
 
-                            if (!a_ec.failed()) {
-                                dispatch();
-                            }
+            co_return value;
+        }
+    };
+#endif
 
-                            begin_accept_message();
-                        }
-                );
-            }
+    /// Write the first a_size bytes of a_data as a frame, prefixed with its length.
+    template <typename t_stream>
+    void write_frame(t_stream& a_stream, const uint8_t* a_data, size_t a_size) {
+        auto size = static_cast<frame_size>(a_size);
 
-            void run() {
-                while (m_running) {
-                    m_context.poll_one();
-                }
-            }
+        std::array<boost::asio::const_buffer, 2> buffers {
+            boost::asio::buffer(&size, sizeof(size)),
+            boost::asio::buffer(a_data, a_size)
         };
+
+        boost::asio::write(a_stream, buffers);
     }
 
-    namespace server {
-        class net;
+    /// Write several messages as frames with one gathered write.
+    template <typename t_stream>
+    void write_frames(t_stream& a_stream, const std::vector<const message*>& a_messages, error_code& a_ec) {
+        std::vector<frame_size> sizes;
+        std::vector<boost::asio::const_buffer> buffers;
 
-        class client {
-            friend class net;
+        sizes.reserve(a_messages.size());
+        buffers.reserve(a_messages.size() * 2);
 
-            socket m_socket;
-            size_t m_id;
+        for (auto* msg : a_messages) {
+            sizes.push_back(static_cast<frame_size>(msg->get_size()));
+            buffers.push_back(boost::asio::buffer(&sizes.back(), sizeof(frame_size)));
+            buffers.push_back(boost::asio::buffer(msg->get_buffer().data(), msg->get_size()));
+        }
 
-        public:
-            client(socket a_socket, size_t a_id) : m_socket(std::move(a_socket)), m_id(a_id) {}
+        boost::asio::write(a_stream, buffers, a_ec);
+    }
 
-            [[nodiscard]] bool operator == (const client& a_rhs) const noexcept {
-                return m_id == a_rhs.m_id;
+#if defined(SR_NET_IO_URING)
+    /// Receive buffers for many connections in one allocation, registered with the io_uring instance
+    /// so that reads into them skip pinning the pages on every operation.
+    class registered_buffer_pool {
+        std::vector<uint8_t> m_storage;
+        std::vector<boost::asio::mutable_buffer> m_buffers;
+        std::optional<boost::asio::buffer_registration<std::vector<boost::asio::mutable_buffer>>> m_registration;
+        std::vector<size_t> m_free;
+
+    public:
+        static constexpr size_t npos = SIZE_MAX;
+
+        registered_buffer_pool(io_context& a_context, size_t a_count, size_t a_size) : m_storage(a_count * a_size) {
+            for (size_t i = 0; i < a_count; ++i) {
+                m_buffers.push_back(boost::asio::buffer(m_storage.data() + i * a_size, a_size));
+                m_free.push_back(a_count - i - 1);
             }
-        };
 
-        SR_DISPATCHER(connect, client&);
-        SR_DISPATCHER(disconnect, client&);
-        SR_DISPATCHER(message, client&);
-        SR_DISPATCHER(ready, client&);
+            m_registration.emplace(boost::asio::register_buffers(a_context, m_buffers));
+        }
 
-        class net :
-            public net_interface<client&>,
-            public connect_dispatcher,
-            public disconnect_dispatcher,
-            public message_dispatcher,
-            public ready_dispatcher
-        {
-            io_context m_context;
-            std::unique_ptr<acceptor> m_acceptor;
+        /// Take a free buffer, or npos if all are in use.
+        [[nodiscard]] size_t acquire() {
+            if (m_free.empty()) {
+                return npos;
+            }
 
-            std::thread m_thread; ///< Thead to manage incoming connections and messages.
-            bool m_running;       ///< Control boolean for thread.
+            auto slot = m_free.back();
+            m_free.pop_back();
+            return slot;
+        }
 
-            std::vector<std::unique_ptr<client>> m_clients; ///< List of all connected clients.
-            std::mutex m_clients_guard;                     ///< Guard to synchronize changes to client list.
+        void release(size_t a_slot) {
+            m_free.push_back(a_slot);
+        }
 
-            size_t m_id_counter = 0; ///< Current counter for assigning connection IDs. Increments on each new connection.
+        [[nodiscard]] boost::asio::mutable_registered_buffer at(size_t a_slot) const {
+            return m_registration->at(a_slot);
+        }
 
-        public:
-            net() : m_context(), m_running(false), m_acceptor() {
-                set_buffer_size(8192);
+        /// Unregister the buffers from the io_context. Must happen before the context is destroyed; the pool
+        /// itself may live on in clients that still hold slots, but at() is unusable afterwards.
+        void unregister() {
+            m_registration.reset();
+        }
+    };
+#endif
+
+    /// Kind of connection named by an endpoint string.
+    enum class transport_kind : uint8_t {
+        tcp,
+        local,
+        shared_memory
+    };
 
-                add_network_string("NET_MESSAGE_SCHEMA", true);
-                add_network_string("NET_SIGNAL_READY", true);
+    /// Where to connect or listen: "tcp://host:port", "unix:///path/to.sock" or "shm:///path/to.sock".
+    /// A shared memory connection is set up over a Unix domain socket at the path.
+    struct endpoint {
+        transport_kind m_kind = transport_kind::tcp;
+        std::string m_host;
+        port_type m_port = 0;
+        std::string m_path;
 
-                receive("NET_SIGNAL_READY", [this](client& a_client) {
-                    dispatch_ready(a_client);
-                });
-            }
+        [[nodiscard]] static endpoint parse(std::string_view a_text) {
+            endpoint result;
 
-            void open(port_type a_port) {
-                m_acceptor = std::make_unique<acceptor>(
-                    m_context,
-                    boost::asio::ip::tcp::endpoint(
-                        boost::asio::ip::tcp::v4(),
-                        a_port
-                    )
-                );
+            auto scheme_end = a_text.find("://");
 
-                begin_accept();
+            if (scheme_end == std::string_view::npos) {
+                throw std::invalid_argument("endpoint has no scheme");
             }
 
-            void start_async() {
-                m_running = true;
-                m_thread = std::thread(&net::run, this);
-            }
+            auto scheme = a_text.substr(0, scheme_end);
+            auto rest = a_text.substr(scheme_end + 3);
 
-            void stop_async() {
-                m_running = false;
+            if (scheme == "tcp") {
+                auto colon = rest.rfind(':');
 
-                if (m_thread.joinable()) {
-                    m_thread.join();
+                if (colon == std::string_view::npos) {
+                    throw std::invalid_argument("tcp endpoint has no port");
                 }
-            }
 
-            void start_sync() {
-                m_running = true;
-                run();
+                result.m_host = std::string(rest.substr(0, colon));
+                result.m_port = static_cast<port_type>(std::stoul(std::string(rest.substr(colon + 1))));
+                return result;
             }
 
-            void poll() {
-                m_context.poll();
+            if (scheme == "unix") {
+                result.m_kind = transport_kind::local;
+            } else if (scheme == "shm") {
+                result.m_kind = transport_kind::shared_memory;
+            } else {
+                throw std::invalid_argument("unknown endpoint scheme");
             }
 
-            auto& get_clients() {
-                return m_clients;
-            }
+#if !defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+            throw std::invalid_argument("local endpoints are not supported on this platform");
+#endif
 
-            auto find_client_by_id(size_t a_id) {
+            result.m_path = std::string(rest);
+            return result;
+        }
+    };
+
+    class shm_stream;
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+    using local_socket = boost::asio::local::stream_protocol::socket;
+    using local_acceptor = boost::asio::local::stream_protocol::acceptor;
+
+    /// Connection between two processes on the same host through shared memory. Each direction is a
+    /// single-producer single-consumer byte ring. The Unix domain socket the connection was made over
+    /// stays open as a doorbell: a reader that finds its ring empty, or a writer that finds it full,
+    /// spins briefly, then parks on the socket, and the other side only sends a byte when it sees the
+    /// park. Closing the socket tells the peer the connection is gone.
+    ///
+    /// Messages cross without a system call only while the reader is spinning, which needs the peers on
+    /// separate cores. On a single core every wakeup goes through the doorbell, so a round trip costs
+    /// about as much as over a plain Unix domain socket, and only bulk transfers gain from skipping the
+    /// kernel's copies.
+    class shm_stream {
+        static constexpr size_t ring_size = 1 << 20;  ///< Bytes per direction. Must be a power of two.
+        static constexpr size_t spin_limit = 4096;    ///< Empty or full polls before a reader or writer parks on the doorbell.
+
+        /// Spinning only pays off when the writer runs on another core at the same time.
+        [[nodiscard]] static size_t spins_before_park() {
+            static const size_t spins = std::thread::hardware_concurrency() > 1 ? spin_limit : 0;
+            return spins;
+        }
+
+        struct ring {
+            alignas(64) std::atomic<uint64_t> m_head { 0 };   ///< Total bytes written.
+            alignas(64) std::atomic<uint64_t> m_tail { 0 };   ///< Total bytes read.
+            alignas(64) std::atomic<uint32_t> m_parked { 0 }; ///< Whether the reader is waiting on the doorbell.
+            std::atomic<uint32_t> m_writer_parked { 0 };      ///< Whether the writer is waiting on the doorbell for space.
+            std::atomic<uint32_t> m_closed { 0 };             ///< Whether either side has closed.
+            alignas(64) uint8_t m_data[ring_size];
+        };
+
+        local_socket m_doorbell;
+        std::unique_ptr<boost::interprocess::mapped_region> m_region;
+        ring* m_in = nullptr;
+        ring* m_out = nullptr;
+        std::string m_name; ///< Segment name, kept by the side that created it so it can remove it.
+
+        explicit shm_stream(local_socket a_doorbell) : m_doorbell(std::move(a_doorbell)) {}
+
+    public:
+        using executor_type = local_socket::executor_type;
+
+        shm_stream(shm_stream&&) = default;
+        shm_stream& operator = (shm_stream&&) = default;
+
+        ~shm_stream() {
+            if (m_region) {
+                m_in->m_closed = 1;
+                m_out->m_closed = 1;
+            }
+
+            if (!m_name.empty()) {
+                boost::interprocess::shared_memory_object::remove(m_name.c_str());
+            }
+        }
+
+        /// Create the shared segment for an accepted connection and send its name to the peer.
+        [[nodiscard]] static shm_stream create(local_socket a_doorbell) {
+            static std::atomic<uint32_t> counter = 0;
+
+            shm_stream stream(std::move(a_doorbell));
+            stream.m_name = "sr-net-" + std::to_string(std::random_device()()) + "-" + std::to_string(counter++);
+
+            boost::interprocess::shared_memory_object segment(boost::interprocess::create_only, stream.m_name.c_str(), boost::interprocess::read_write);
+            segment.truncate(sizeof(ring) * 2);
+
+            stream.m_region = std::make_unique<boost::interprocess::mapped_region>(segment, boost::interprocess::read_write);
+
+            auto* base = static_cast<uint8_t*>(stream.m_region->get_address());
+            stream.m_in = new (base) ring();
+            stream.m_out = new (base + sizeof(ring)) ring();
+
+            write_frame(stream.m_doorbell, reinterpret_cast<const uint8_t*>(stream.m_name.data()), stream.m_name.size());
+
+            return stream;
+        }
+
+        /// Map the segment named by the accepting side.
+        [[nodiscard]] static shm_stream open(local_socket a_doorbell) {
+            shm_stream stream(std::move(a_doorbell));
+
+            frame_size size = 0;
+            boost::asio::read(stream.m_doorbell, boost::asio::buffer(&size, sizeof(size)));
+
+            if (size == 0 || size > 255) {
+                throw std::runtime_error("malformed shared memory handshake");
+            }
+
+            std::string name(size, '\0');
+            boost::asio::read(stream.m_doorbell, boost::asio::buffer(name.data(), size));
+
+            boost::interprocess::shared_memory_object segment(boost::interprocess::open_only, name.c_str(), boost::interprocess::read_write);
+            stream.m_region = std::make_unique<boost::interprocess::mapped_region>(segment, boost::interprocess::read_write);
+
+            if (stream.m_region->get_size() < sizeof(ring) * 2) {
+                throw std::runtime_error("shared memory segment is too small");
+            }
+
+            // Both sides have it mapped now; the segment goes away with the last mapping.
+            boost::interprocess::shared_memory_object::remove(name.c_str());
+
+            auto* base = static_cast<uint8_t*>(stream.m_region->get_address());
+            stream.m_out = reinterpret_cast<ring*>(base);
+            stream.m_in = reinterpret_cast<ring*>(base + sizeof(ring));
+
+            return stream;
+        }
+
+        executor_type get_executor() {
+            return m_doorbell.get_executor();
+        }
+
+        [[nodiscard]] bool is_open() const {
+            return m_doorbell.is_open();
+        }
+
+        void close(error_code& a_ec) {
+            if (m_region) {
+                m_in->m_closed = 1;
+                m_out->m_closed = 1;
+            }
+
+            m_doorbell.close(a_ec);
+        }
+
+        template <typename t_buffers, typename t_token>
+        auto async_read_some(const t_buffers& a_buffers, t_token&& a_token) {
+            return boost::asio::async_compose<t_token, void (error_code, std::size_t)>(
+                [this, a_buffers, started = false, parked = false, spins = size_t(0)](auto& a_self, error_code a_ec = {}) mutable {
+                    // Never complete inside the initiating call.
+                    if (!started) {
+                        started = true;
+                        boost::asio::post(m_doorbell.get_executor(), std::move(a_self));
+                        return;
+                    }
+
+                    if (a_ec.failed()) {
+                        a_self.complete(a_ec, 0);
+                        return;
+                    }
+
+                    bool hung_up = parked && !drain_doorbell();
+                    parked = false;
+
+                    error_code ec;
+                    auto size = try_read(a_buffers, ec);
+
+                    if (size > 0 || ec.failed() || boost::asio::buffer_size(a_buffers) == 0) {
+                        a_self.complete(ec, size);
+                        return;
+                    }
+
+                    if (hung_up) {
+                        a_self.complete(boost::asio::error::eof, 0);
+                        return;
+                    }
+
+                    if (spins++ < spins_before_park()) {
+                        boost::asio::post(m_doorbell.get_executor(), std::move(a_self));
+                        return;
+                    }
+
+                    // Announce the park, then look again so a write racing with it is not missed.
+                    spins = 0;
+                    m_in->m_parked = 1;
+
+                    if (m_in->m_head != m_in->m_tail.load(std::memory_order_relaxed) || m_in->m_closed) {
+                        m_in->m_parked = 0;
+                        boost::asio::post(m_doorbell.get_executor(), std::move(a_self));
+                        return;
+                    }
+
+                    parked = true;
+                    m_doorbell.async_wait(local_socket::wait_read, std::move(a_self));
+                },
+                a_token, m_doorbell
+            );
+        }
+
+        template <typename t_buffers, typename t_token>
+        auto async_write_some(const t_buffers& a_buffers, t_token&& a_token) {
+            return boost::asio::async_compose<t_token, void (error_code, std::size_t)>(
+                [this, a_buffers, started = false, parked = false, spins = size_t(0)](auto& a_self, error_code a_ec = {}) mutable {
+                    if (!started) {
+                        started = true;
+                        boost::asio::post(m_doorbell.get_executor(), std::move(a_self));
+                        return;
+                    }
+
+                    if (a_ec.failed()) {
+                        a_self.complete(a_ec, 0);
+                        return;
+                    }
+
+                    bool hung_up = parked && !drain_doorbell();
+                    parked = false;
+
+                    error_code ec;
+                    auto size = try_write(a_buffers, ec);
+
+                    if (size > 0 || ec.failed() || boost::asio::buffer_size(a_buffers) == 0) {
+                        a_self.complete(ec, size);
+                        return;
+                    }
+
+                    if (hung_up) {
+                        a_self.complete(boost::asio::error::broken_pipe, 0);
+                        return;
+                    }
+
+                    // The ring is full.
+                    if (spins++ < spins_before_park()) {
+                        boost::asio::post(m_doorbell.get_executor(), std::move(a_self));
+                        return;
+                    }
+
+                    // Announce the park, then look again so a read racing with it is not missed.
+                    spins = 0;
+                    m_out->m_writer_parked = 1;
+
+                    if (has_space() || m_out->m_closed) {
+                        m_out->m_writer_parked = 0;
+                        boost::asio::post(m_doorbell.get_executor(), std::move(a_self));
+                        return;
+                    }
+
+                    parked = true;
+                    m_doorbell.async_wait(local_socket::wait_read, std::move(a_self));
+                },
+                a_token, m_doorbell
+            );
+        }
+
+        /// Write at least one byte, waiting for the reader while the ring is full.
+        template <typename t_buffers>
+        size_t write_some(const t_buffers& a_buffers, error_code& a_ec) {
+            a_ec = {};
+
+            if (boost::asio::buffer_size(a_buffers) == 0) {
+                return 0;
+            }
+
+            for (size_t spins = 0;;) {
+                auto size = try_write(a_buffers, a_ec);
+
+                if (size > 0 || a_ec.failed()) {
+                    return size;
+                }
+
+                if (spins++ < spins_before_park()) {
+                    std::this_thread::yield();
+                    continue;
+                }
+
+                spins = 0;
+                m_out->m_writer_parked = 1;
+
+                if (has_space() || m_out->m_closed) {
+                    m_out->m_writer_parked = 0;
+                    continue;
+                }
+
+                m_doorbell.wait(local_socket::wait_read, a_ec);
+
+                if (a_ec.failed()) {
+                    return 0;
+                }
+
+                if (!drain_doorbell()) {
+                    a_ec = boost::asio::error::broken_pipe;
+                    return 0;
+                }
+            }
+        }
+
+    private:
+        template <typename t_buffers>
+        size_t try_read(const t_buffers& a_buffers, error_code& a_ec) {
+            auto tail = m_in->m_tail.load(std::memory_order_relaxed);
+            auto available = m_in->m_head.load(std::memory_order_acquire) - tail;
+
+            if (available == 0) {
+                if (m_in->m_closed) {
+                    a_ec = boost::asio::error::eof;
+                }
+
+                return 0;
+            }
+
+            size_t total = 0;
+
+            for (auto it = boost::asio::buffer_sequence_begin(a_buffers); it != boost::asio::buffer_sequence_end(a_buffers) && available > 0; ++it) {
+                boost::asio::mutable_buffer buffer(*it);
+                auto size = static_cast<size_t>(std::min<uint64_t>(buffer.size(), available));
+
+                auto offset = static_cast<size_t>((tail + total) & (ring_size - 1));
+                auto first = std::min(size, ring_size - offset);
+                std::memcpy(buffer.data(), m_in->m_data + offset, first);
+                std::memcpy(static_cast<uint8_t*>(buffer.data()) + first, m_in->m_data, size - first);
+
+                total += size;
+                available -= size;
+            }
+
+            m_in->m_tail = tail + total;
+
+            if (m_in->m_writer_parked && m_in->m_writer_parked.exchange(0)) {
+                ring_doorbell();
+            }
+
+            return total;
+        }
+
+        template <typename t_buffers>
+        size_t try_write(const t_buffers& a_buffers, error_code& a_ec) {
+            if (m_out->m_closed) {
+                a_ec = boost::asio::error::broken_pipe;
+                return 0;
+            }
+
+            auto head = m_out->m_head.load(std::memory_order_relaxed);
+            auto space = ring_size - (head - m_out->m_tail.load(std::memory_order_acquire));
+            size_t total = 0;
+
+            for (auto it = boost::asio::buffer_sequence_begin(a_buffers); it != boost::asio::buffer_sequence_end(a_buffers) && space > 0; ++it) {
+                boost::asio::const_buffer buffer(*it);
+                auto size = static_cast<size_t>(std::min<uint64_t>(buffer.size(), space));
+
+                auto offset = static_cast<size_t>((head + total) & (ring_size - 1));
+                auto first = std::min(size, ring_size - offset);
+                std::memcpy(m_out->m_data + offset, buffer.data(), first);
+                std::memcpy(m_out->m_data, static_cast<const uint8_t*>(buffer.data()) + first, size - first);
+
+                total += size;
+                space -= size;
+            }
+
+            if (total == 0) {
+                return 0;
+            }
+
+            m_out->m_head = head + total;
+
+            if (m_out->m_parked && m_out->m_parked.exchange(0)) {
+                ring_doorbell();
+            }
+
+            return total;
+        }
+
+        [[nodiscard]] bool has_space() const {
+            return m_out->m_head.load(std::memory_order_relaxed) - m_out->m_tail < ring_size;
+        }
+
+        void ring_doorbell() {
+            uint8_t bell = 1;
+            error_code ec;
+            m_doorbell.write_some(boost::asio::buffer(&bell, sizeof(bell)), ec);
+        }
+
+        /// Consume doorbell bytes after a wakeup. Returns false if the peer has hung up. The reader and a
+        /// parked writer share the doorbell, so the other one may have taken the bytes already; the read
+        /// must not wait for more.
+        bool drain_doorbell() {
+            uint8_t bells[64];
+            auto size = ::recv(m_doorbell.native_handle(), bells, sizeof(bells), MSG_DONTWAIT);
+
+            return size > 0 || (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR));
+        }
+    };
+#endif
+
+    /// Stream a connection runs over: TCP, a Unix domain socket or shared memory. Meets Asio's stream
+    /// requirements, so framing and handlers are the same for all of them.
+    class transport {
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+        std::variant<socket, local_socket, shm_stream> m_impl;
+#else
+        std::variant<socket> m_impl;
+#endif
+
+        template <typename t_stream>
+        static constexpr bool is_shm = std::is_same_v<std::decay_t<t_stream>, shm_stream>;
+
+    public:
+        using executor_type = socket::executor_type;
+
+        explicit transport(io_context& a_context) : m_impl(std::in_place_type<socket>, a_context) {}
+        transport(socket a_socket) : m_impl(std::move(a_socket)) {}
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+        transport(local_socket a_socket) : m_impl(std::move(a_socket)) {}
+        transport(shm_stream a_stream) : m_impl(std::move(a_stream)) {}
+#endif
+
+        executor_type get_executor() {
+            return std::visit([](auto& a_stream) -> executor_type {
+                return a_stream.get_executor();
+            }, m_impl);
+        }
+
+        [[nodiscard]] bool is_open() const {
+            return std::visit([](const auto& a_stream) {
+                return a_stream.is_open();
+            }, m_impl);
+        }
+
+        [[nodiscard]] bool is_shared_memory() const {
+            return std::visit([](const auto& a_stream) {
+                return is_shm<decltype(a_stream)>;
+            }, m_impl);
+        }
+
+        void close(error_code& a_ec) {
+            std::visit([&a_ec](auto& a_stream) {
+                a_stream.close(a_ec);
+            }, m_impl);
+        }
+
+        template <typename t_buffers, typename t_token>
+        auto async_read_some(const t_buffers& a_buffers, t_token&& a_token) {
+            return boost::asio::async_initiate<t_token, void (error_code, std::size_t)>(
+                [this](auto a_handler, const t_buffers& a_buffers) {
+                    std::visit([&](auto& a_stream) {
+                        a_stream.async_read_some(a_buffers, std::move(a_handler));
+                    }, m_impl);
+                },
+                a_token, a_buffers
+            );
+        }
+
+        template <typename t_buffers, typename t_token>
+        auto async_write_some(const t_buffers& a_buffers, t_token&& a_token) {
+            return boost::asio::async_initiate<t_token, void (error_code, std::size_t)>(
+                [this](auto a_handler, const t_buffers& a_buffers) {
+                    std::visit([&](auto& a_stream) {
+                        a_stream.async_write_some(a_buffers, std::move(a_handler));
+                    }, m_impl);
+                },
+                a_token, a_buffers
+            );
+        }
+
+        template <typename t_buffers>
+        size_t write_some(const t_buffers& a_buffers, error_code& a_ec) {
+            return std::visit([&](auto& a_stream) {
+                return a_stream.write_some(a_buffers, a_ec);
+            }, m_impl);
+        }
+
+        template <typename t_buffers>
+        size_t write_some(const t_buffers& a_buffers) {
+            error_code ec;
+            auto size = write_some(a_buffers, ec);
+
+            if (ec.failed()) {
+                throw boost::system::system_error(ec);
+            }
+
+            return size;
+        }
+
+        // Descriptor operations for sendfile() and splice(). The shared memory transport has no descriptor
+        // to hand out; check is_shared_memory() first.
+
+        [[nodiscard]] socket::native_handle_type native_handle() {
+            return std::visit([](auto& a_stream) -> socket::native_handle_type {
+                if constexpr (is_shm<decltype(a_stream)>) {
+                    throw std::logic_error("shared memory transport has no descriptor");
+                } else {
+                    return a_stream.native_handle();
+                }
+            }, m_impl);
+        }
+
+        void wait(socket::wait_type a_type) {
+            std::visit([a_type](auto& a_stream) {
+                if constexpr (is_shm<decltype(a_stream)>) {
+                    throw std::logic_error("shared memory transport has no descriptor");
+                } else {
+                    a_stream.wait(a_type);
+                }
+            }, m_impl);
+        }
+
+        /// Shared memory counts as always writable; its writes only wait while the ring is full.
+        template <typename t_handler>
+        void async_wait(socket::wait_type a_type, t_handler&& a_handler) {
+            std::visit([&](auto& a_stream) {
+                if constexpr (is_shm<decltype(a_stream)>) {
+                    if (a_type != socket::wait_write) {
+                        throw std::logic_error("shared memory transport has no descriptor");
+                    }
+
+                    boost::asio::post(a_stream.get_executor(), [handler = std::forward<t_handler>(a_handler)]() mutable {
+                        handler(error_code());
+                    });
+                } else {
+                    a_stream.async_wait(a_type, std::forward<t_handler>(a_handler));
+                }
+            }, m_impl);
+        }
+    };
+
+    /// Allowed rate per second, with bursts up to m_burst. A rate of zero means no limit.
+    struct rate_limit {
+        double m_rate = 0;
+        double m_burst = 0; ///< Zero means one second's worth.
+
+        [[nodiscard]] bool is_limited() const {
+            return m_rate > 0;
+        }
+
+        [[nodiscard]] double burst() const {
+            return m_burst > 0 ? m_burst : m_rate;
+        }
+    };
+
+    /// Token bucket for one rate_limit. Tokens may go into debt, which is paid off at the limit's rate.
+    class token_bucket {
+        double m_tokens = 0;
+        std::chrono::steady_clock::time_point m_last;
+        bool m_started = false;
+
+    public:
+        void refill(const rate_limit& a_limit, std::chrono::steady_clock::time_point a_now) {
+            if (!m_started) {
+                m_tokens = a_limit.burst();
+                m_last = a_now;
+                m_started = true;
+                return;
+            }
+
+            std::chrono::duration<double> elapsed = a_now - m_last;
+            m_tokens = std::min(a_limit.burst(), m_tokens + elapsed.count() * a_limit.m_rate);
+            m_last = a_now;
+        }
+
+        [[nodiscard]] bool available(double a_cost) const {
+            return m_tokens >= a_cost;
+        }
+
+        /// Take tokens, going into debt if there are not enough. Returns the time until the debt is paid off.
+        std::chrono::nanoseconds take(const rate_limit& a_limit, double a_cost) {
+            m_tokens -= a_cost;
+
+            if (m_tokens >= 0) {
+                return std::chrono::nanoseconds(0);
+            }
+
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double>(-m_tokens / a_limit.m_rate));
+        }
+    };
+
+    /// What to do with a message from a client over its limits.
+    enum class limit_policy : uint8_t {
+        throttle,  ///< Handle it, then stop reading from the client until it is back within its limits.
+        drop,      ///< Discard it.
+        disconnect ///< Disconnect the client.
+    };
+
+    /// Limits applied to every client's inbound messages.
+    struct admission_policy {
+        rate_limit m_messages;                          ///< Messages per second from each client.
+        rate_limit m_bytes;                             ///< Bytes per second from each client.
+        size_t m_max_frame_size = 0;                    ///< Largest frame accepted. Zero means the buffer size.
+        size_t m_max_topics = 1024;                     ///< Most topics one client may subscribe to. Zero means no limit.
+        limit_policy m_policy = limit_policy::throttle;
+    };
+
+    /// Destination for the body of an incoming stream.
+    struct stream_sink {
+        void* m_buffer = nullptr; ///< Caller buffer of at least the stream length. Takes precedence over m_path.
+        std::string m_path;       ///< File to write the body to. If both are empty, the body is discarded.
+    };
+
+    /// Handle to an outstanding remote procedure call.
+    class rpc_call {
+        uint32_t m_id;
+        std::future<message> m_result;
+
+    public:
+        rpc_call(uint32_t a_id, std::future<message> a_result) : m_id(a_id), m_result(std::move(a_result)) {}
+
+        [[nodiscard]] uint32_t get_id() const noexcept {
+            return m_id;
+        }
+
+        [[nodiscard]] std::future<message>& get_future() noexcept {
+            return m_result;
+        }
+
+        /// Wait for the response. Throws boost::system::system_error on timeout, cancellation or disconnect.
+        [[nodiscard]] message get() {
+            return m_result.get();
+        }
+    };
+
+    enum class capture_direction : uint8_t {
+        received = 0,
+        sent = 1
+    };
+
+    /// Header in front of each frame in a capture file. The frame payload follows it.
+    struct capture_record {
+        uint64_t m_time;       ///< Steady clock time in nanoseconds. Only differences between records are meaningful.
+        uint64_t m_client_id;
+        uint64_t m_message_id;
+        uint32_t m_size;       ///< Size of the frame payload in bytes.
+        capture_direction m_direction;
+    };
+
+    /// Header at the start of a capture file.
+    struct capture_header {
+        char m_magic[8];
+        uint64_t m_end; ///< Offset just past the last complete record.
+    };
+
+    inline constexpr char capture_magic[8] = "SRCAP01";
+
+    /// Append-only, memory-mapped log of network frames.
+    class capture_log {
+        static constexpr size_t grow_size = 16 * 1024 * 1024;
+
+        std::string m_path;
+        boost::interprocess::mapped_region m_region;
+        size_t m_end = sizeof(capture_header);
+        std::mutex m_guard; ///< Sends may come from any thread.
+
+    public:
+        explicit capture_log(std::string a_path) : m_path(std::move(a_path)) {
+            std::ofstream(m_path, std::ios::binary | std::ios::trunc);
+
+            map(grow_size);
+
+            capture_header header {};
+            std::memcpy(header.m_magic, capture_magic, sizeof(capture_magic));
+            header.m_end = m_end;
+            std::memcpy(m_region.get_address(), &header, sizeof(header));
+        }
+
+        capture_log(const capture_log&) = delete;
+        capture_log& operator = (const capture_log&) = delete;
+
+        ~capture_log() {
+            m_region.flush();
+            m_region = boost::interprocess::mapped_region();
+
+            // Trim the unused tail of the last growth step.
+            std::filesystem::resize_file(m_path, m_end);
+        }
+
+        void append(capture_direction a_direction, uint64_t a_client_id, const uint8_t* a_data, size_t a_size) {
+            capture_record record {};
+            record.m_client_id = a_client_id;
+            record.m_size = static_cast<uint32_t>(a_size);
+            record.m_direction = a_direction;
+
+            if (a_size >= sizeof(size_t)) {
+                std::memcpy(&record.m_message_id, a_data, sizeof(size_t));
+            }
+
+            std::lock_guard<std::mutex> lock(m_guard);
+
+            // Stamped under the lock, so times never decrease along the file.
+            record.m_time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+
+            size_t required = m_end + sizeof(record) + a_size;
+
+            if (required > m_region.get_size()) {
+                map(std::max(required, m_region.get_size() + grow_size));
+            }
+
+            auto* base = static_cast<uint8_t*>(m_region.get_address());
+
+            std::memcpy(base + m_end, &record, sizeof(record));
+            std::memcpy(base + m_end + sizeof(record), a_data, a_size);
+            m_end = required;
+
+            std::memcpy(base + offsetof(capture_header, m_end), &m_end, sizeof(uint64_t));
+        }
+
+    private:
+        void map(size_t a_size) {
+            m_region = boost::interprocess::mapped_region();
+
+            std::filesystem::resize_file(m_path, a_size);
+
+            boost::interprocess::file_mapping file(m_path.c_str(), boost::interprocess::read_write);
+            m_region = boost::interprocess::mapped_region(file, boost::interprocess::read_write);
+        }
+    };
+
+    /// Sequential reader for files written by capture_log.
+    class capture_reader {
+        boost::interprocess::file_mapping m_file;
+        boost::interprocess::mapped_region m_region;
+        size_t m_offset = sizeof(capture_header);
+        size_t m_end = 0;
+
+    public:
+        explicit capture_reader(const std::string& a_path) :
+            m_file(a_path.c_str(), boost::interprocess::read_only),
+            m_region(m_file, boost::interprocess::read_only)
+        {
+            capture_header header {};
+
+            if (m_region.get_size() < sizeof(header)) {
+                throw std::invalid_argument("not a capture file");
+            }
+
+            std::memcpy(&header, m_region.get_address(), sizeof(header));
+
+            if (std::memcmp(header.m_magic, capture_magic, sizeof(capture_magic)) != 0) {
+                throw std::invalid_argument("not a capture file");
+            }
+
+            m_end = std::min<size_t>(header.m_end, m_region.get_size());
+        }
+
+        /// Read the next record. a_payload points into the mapping and stays valid as long as the reader.
+        bool next(capture_record& a_record, const uint8_t*& a_payload) {
+            if (m_offset + sizeof(capture_record) > m_end) {
+                return false;
+            }
+
+            auto* base = static_cast<const uint8_t*>(m_region.get_address());
+
+            std::memcpy(&a_record, base + m_offset, sizeof(a_record));
+
+            if (m_offset + sizeof(a_record) + a_record.m_size > m_end) {
+                return false;
+            }
+
+            a_payload = base + m_offset + sizeof(a_record);
+            m_offset += sizeof(a_record) + a_record.m_size;
+
+            return true;
+        }
+    };
+
+    namespace client { class net; }
+    namespace server { class net; }
+
+    template <typename... t_dispatch_args>
+    class net_interface : public message {
+        friend client::net;
+        friend server::net;
+
+        std::vector<std::unique_ptr<std::string>> m_message_ids;
+        std::unordered_map<std::string_view, size_t> m_message_id_map;
+        std::map<std::string_view, std::function<void (t_dispatch_args&&...)>> m_message_handlers;
+        std::unordered_map<size_t, std::function<void (t_dispatch_args&&...)>*> m_message_handlers_id_map;
+        std::vector<std::string_view> m_no_send_ids;
+        size_t m_builtin_id_count = 0; ///< IDs 1 to this belong to add_builtin_network_strings().
+
+    public:
+        /// Handler run on the worker pool with its own copy of the message.
+        using offload_handler = std::function<void (message&, t_dispatch_args&&...)>;
+
+    private:
+        std::map<std::string_view, offload_handler> m_offload_handlers;
+        std::unordered_map<size_t, offload_handler*> m_offload_handlers_id_map;
+
+    public:
+        void clear_message_ids() {
+            m_message_ids.clear();
+            m_message_id_map.clear();
+            m_message_handlers_id_map.clear();
+            m_offload_handlers_id_map.clear();
+            m_no_send_ids.clear();
+        }
+
+        void add_network_string(std::string a_string, bool a_no_send = false) {
+            m_message_ids.emplace_back(std::make_unique<std::string>(std::move(a_string)));
+            std::string_view str = *m_message_ids.back();
+            m_message_id_map[str] = m_message_ids.size();
+
+            bind_handlers(str, m_message_ids.size());
+
+            if (a_no_send) {
+                m_no_send_ids.push_back(str);
+            }
+        }
+
+        /// Add the network strings the library itself uses. Both sides must add them in the same order.
+        void add_builtin_network_strings() {
+            add_network_string("NET_MESSAGE_SCHEMA", true);
+            add_network_string("NET_SIGNAL_READY", true);
+            add_network_string("NET_RPC_RESPONSE", true);
+            add_network_string("NET_STREAM", true);
+            add_network_string("NET_SUBSCRIBE", true);
+            add_network_string("NET_UNSUBSCRIBE", true);
+
+            m_builtin_id_count = m_message_ids.size();
+        }
+
+        /// Whether an ID is one of the network strings the library itself uses.
+        [[nodiscard]] bool is_builtin_id(size_t a_id) const {
+            return a_id != 0 && a_id <= m_builtin_id_count;
+        }
+
+        [[nodiscard]] size_t network_string_to_id(std::string_view a_string) {
+            return m_message_id_map[a_string];
+        }
+
+        [[nodiscard]] std::string_view id_to_network_string(size_t a_string) {
+            auto it = std::find_if(m_message_id_map.begin(), m_message_id_map.end(), [a_string](auto& entry) {
+                return entry.second == a_string;
+            });
+
+            return it->second;
+        }
+
+        void receive(std::string_view a_id, std::function<void (t_dispatch_args&&...)> a_callback) {
+            auto handler_it = m_message_handlers.emplace(a_id, std::move(a_callback));
+
+            auto it = m_message_id_map.find(a_id);
+
+            if (it == m_message_id_map.cend()) {
+                return;
+            }
+
+            m_message_handlers_id_map.emplace(it->second, &handler_it.first->second);
+        }
+
+        /// Register a handler that runs on the worker pool instead of the io thread.
+        /// Messages from the same connection are still handled in the order they arrived.
+        void receive_offload(std::string_view a_id, offload_handler a_callback) {
+            auto handler_it = m_offload_handlers.emplace(a_id, std::move(a_callback));
+
+            auto it = m_message_id_map.find(a_id);
+
+            if (it == m_message_id_map.cend()) {
+                return;
+            }
+
+            m_offload_handlers_id_map.emplace(it->second, &handler_it.first->second);
+        }
+
+        /// Create a standalone message, e.g. to build a reply on a worker thread.
+        [[nodiscard]] message create_message(std::string_view a_id) const {
+            auto id_it = m_message_id_map.find(a_id);
+
+            if (id_it == m_message_id_map.cend()) {
+                throw std::invalid_argument("unknown message ID");
+            }
+
+            return message(m_buffer.size(), id_it->second);
+        }
+
+        /// Create the response to an RPC request with the given call ID.
+        [[nodiscard]] message create_reply(uint32_t a_call_id) const {
+            auto reply = create_message("NET_RPC_RESPONSE");
+            reply.write_call_id(a_call_id);
+            return reply;
+        }
+
+        void start(std::string_view a_id) {
+            auto id_it = m_message_id_map.find(a_id);
+
+            if (id_it == m_message_id_map.cend()) {
+                return;
+            }
+
+            m_buffer_index = 0;
+
+            write_to_buffer(id_it->second);
+        }
+
+        /// Compile a schema message in the buffer containing all of the message IDs.
+        void compile_schema() {
+            start("NET_MESSAGE_SCHEMA");
+            write_int(m_message_id_map.size() - m_no_send_ids.size());
+
+            for (auto& entry : m_message_id_map) {
+                if (std::find(m_no_send_ids.begin(), m_no_send_ids.end(), entry.first) != m_no_send_ids.cend()) {
+                    continue;
+                }
+
+                write_string(entry.first);
+                write_int(entry.second);
+            }
+        }
+
+        void dispatch(t_dispatch_args&&... a_args) {
+            auto it = m_message_handlers_id_map.find(read_id());
+
+            if (it == m_message_handlers_id_map.cend()) {
+                return;
+            }
+
+            (*it->second)(std::forward<t_dispatch_args>(a_args)...);
+        }
+
+        /// Check whether an inline handler is registered for the message in the buffer.
+        [[nodiscard]] bool is_handled() {
+            return m_message_handlers_id_map.count(read_id()) != 0;
+        }
+
+        /// Find the worker pool handler for the message in the buffer, or null if it is handled inline.
+        [[nodiscard]] offload_handler* find_offload_handler() {
+            auto it = m_offload_handlers_id_map.find(read_id());
+            return it != m_offload_handlers_id_map.cend() ? it->second : nullptr;
+        }
+
+    private:
+        /// Point a message ID at the handlers registered for its network string, if any.
+        void bind_handlers(std::string_view a_string, size_t a_id) {
+            auto handler_it = m_message_handlers.find(a_string);
+
+            if (handler_it != m_message_handlers.cend()) {
+                m_message_handlers_id_map[a_id] = &handler_it->second;
+            }
+
+            auto offload_it = m_offload_handlers.find(a_string);
+
+            if (offload_it != m_offload_handlers.cend()) {
+                m_offload_handlers_id_map[a_id] = &offload_it->second;
+            }
+        }
+    };
+
+    namespace client {
+        SR_DISPATCHER(connect);
+        SR_DISPATCHER(disconnect);
+        SR_DISPATCHER(message);
+        SR_DISPATCHER(ready);
+
+        class net :
+            public net_interface<>,
+            public connect_dispatcher,
+            public disconnect_dispatcher,
+            public message_dispatcher,
+            public ready_dispatcher
+        {
+            io_context m_context;
+            resolver m_resolver;
+            transport m_socket;
+            bool m_connected = false;
+            frame_size m_frame_size = 0; ///< Size of the frame being read.
+
+            endpoint m_target;                                   ///< Last endpoint connected to, for reconnecting.
+            bool m_reconnect = false;                            ///< Whether to reconnect after a lost connection or failed async_connect().
+            std::chrono::milliseconds m_reconnect_initial_delay = std::chrono::milliseconds(100); ///< Backoff before the first reconnect attempt.
+            std::chrono::milliseconds m_reconnect_max_delay = std::chrono::seconds(30);         ///< Cap on the backoff.
+            unsigned m_reconnect_attempts = 0;                   ///< Reconnect attempts since the last successful connect.
+            boost::asio::steady_timer m_reconnect_timer;
+            bool m_reconnect_pending = false;
+            std::mt19937 m_random { std::random_device()() };    ///< Jitter for the backoff.
+
+            std::thread m_thread;
+            std::atomic<bool> m_running = false;
+
+            bool m_writing = false;                             ///< Whether co_send() owns the socket. Other sends go to m_deferred meanwhile.
+            std::vector<std::vector<uint8_t>> m_deferred;       ///< Frames sent while m_writing, written in order once it completes.
+            std::vector<std::vector<uint8_t>> m_in_flight;      ///< Frames of the deferred write in progress.
+            std::vector<frame_size> m_in_flight_sizes;          ///< Length prefixes of m_in_flight.
+
+            mpsc_queue<message> m_outbound;                     ///< Messages queued by worker threads, sent from the io thread.
+            std::atomic<bool> m_flush_scheduled = false;        ///< Whether a flush of m_outbound is already posted.
+            std::vector<message> m_flush_batch;                 ///< Messages taken from m_outbound for the current flush.
+            std::unique_ptr<worker_pool> m_workers;             ///< Pool for offloaded handlers. Created on demand.
+            std::optional<worker_pool::serial_queue> m_serial; ///< Keeps offloaded handlers in arrival order.
+
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+            awaitable_queue<message> m_inbox;             ///< Messages without a handler, for co_next_message().
+            awaitable_queue<std::monostate> m_handshakes; ///< Signalled each time the schema handshake finishes.
+            bool m_coroutine = false;                     ///< Whether the connection was made with co_connect().
+#endif
+
+            bool m_streaming = false; ///< Whether a stream body follows on the socket instead of a frame.
+
+            struct pending_call {
+                std::function<void (error_code, message)> m_complete;
+                std::shared_ptr<boost::asio::steady_timer> m_timer;
+            };
+
+            std::unordered_map<uint32_t, pending_call> m_calls; ///< Outstanding calls by call ID.
+            std::mutex m_calls_guard;                           ///< Guard for m_calls, since calls may be made from any thread.
+            std::atomic<uint32_t> m_call_counter = 0;           ///< Last assigned call ID.
+            std::chrono::milliseconds m_call_timeout = std::chrono::seconds(30);
+
+        public:
+            using stream_open_handler = std::function<stream_sink (uint64_t a_length)>;
+            using stream_complete_handler = std::function<void (const stream_sink&, error_code)>;
+
+        private:
+            struct stream_handlers {
+                stream_open_handler m_open;
+                stream_complete_handler m_complete;
+            };
+
+            std::unordered_map<std::string, stream_handlers> m_stream_handlers;
+
+        public:
+            /// Head start a connection attempt gets before the next address is tried alongside it (RFC 8305).
+            static constexpr std::chrono::milliseconds connection_attempt_delay = std::chrono::milliseconds(250);
+
+            explicit net() : m_context(), m_resolver(m_context), m_socket(m_context), m_reconnect_timer(m_context) {
+                set_buffer_size(8192);
+
+                add_builtin_network_strings();
+
+                receive("NET_MESSAGE_SCHEMA", [this]() {
+                    clear_message_ids();
+
+                    add_builtin_network_strings();
+
+                    size_t count = read_int();
+
+                    while (count--) {
+                        m_message_ids.push_back(std::make_unique<std::string>(read_string()));
+                        std::string_view str = *m_message_ids.back();
+
+                        size_t id = read_int();
+
+                        m_message_id_map.emplace(str, id);
+
+                        bind_handlers(str, id);
+                    }
+
+                    dispatch_ready();
+
+                    start("NET_SIGNAL_READY");
+                    send();
+
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+                    if (m_coroutine) {
+                        m_handshakes.push({});
+                    }
+#endif
+                });
+
+                receive("NET_RPC_RESPONSE", [this]() {
+                    auto call_id = read_call_id();
+
+                    message response(get_buffer().data(), m_frame_size);
+                    response.read_id();
+                    response.read_call_id();
+
+                    complete_call(call_id, {}, std::move(response));
+                });
+
+                receive("NET_STREAM", [this]() {
+                    auto id = read_string();
+                    uint64_t length = read_int();
+
+                    begin_stream(id, length);
+                });
+            }
+
+            ~net() {
+                stop_async();
+
+                // Offloaded handlers still running use this object, so let them finish before any member goes.
+                if (m_workers) {
+                    m_workers->join();
+                }
+            }
+
+            /// Connect, blocking until the connection is made. Throws boost::system::system_error on failure.
+            void connect(const std::string& a_hostname, port_type a_port) {
+                error_code ec;
+                socket tcp(m_context);
+                auto endpoints = m_resolver.resolve(a_hostname, std::to_string(a_port), ec);
+
+                if (!ec.failed()) {
+                    boost::asio::connect(tcp, endpoints, ec);
+                }
+
+                if (ec.failed()) {
+                    throw boost::system::system_error(ec);
+                }
+
+                m_target = { transport_kind::tcp, a_hostname, a_port, {} };
+                m_socket = std::move(tcp);
+                begin_session();
+            }
+
+            /// Connect to an endpoint string (see endpoint::parse()), blocking until the connection is made.
+            /// Throws boost::system::system_error on failure.
+            void connect(const std::string& a_endpoint) {
+                auto target = endpoint::parse(a_endpoint);
+
+                if (target.m_kind == transport_kind::tcp) {
+                    connect(target.m_host, target.m_port);
+                    return;
+                }
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+                local_socket local(m_context);
+                local.connect(boost::asio::local::stream_protocol::endpoint(target.m_path));
+
+                if (target.m_kind == transport_kind::shared_memory) {
+                    m_socket = shm_stream::open(std::move(local));
+                } else {
+                    m_socket = std::move(local);
+                }
+
+                m_target = std::move(target);
+                begin_session();
+#endif
+            }
+
+            /// Connect without blocking. Addresses are resolved first; IPv6 and IPv4 candidates are then tried
+            /// alternately, each one started if the previous has not connected within connection_attempt_delay,
+            /// and the first to connect wins. a_complete is called on the io thread with the outcome.
+            void async_connect(const std::string& a_hostname, port_type a_port, std::function<void (error_code)> a_complete = {}) {
+                start_connect({ transport_kind::tcp, a_hostname, a_port, {} }, std::move(a_complete));
+            }
+
+            /// async_connect() to an endpoint string (see endpoint::parse()).
+            void async_connect(const std::string& a_endpoint, std::function<void (error_code)> a_complete = {}) {
+                start_connect(endpoint::parse(a_endpoint), std::move(a_complete));
+            }
+
+            /// Reconnect automatically when the connection is lost or async_connect() fails, waiting a jittered,
+            /// exponentially growing delay between attempts. The schema handshake and ready event run again on
+            /// each new connection.
+            void enable_reconnect(std::chrono::milliseconds a_initial_delay = std::chrono::milliseconds(100), std::chrono::milliseconds a_max_delay = std::chrono::seconds(30)) {
+                m_reconnect = true;
+                m_reconnect_initial_delay = a_initial_delay;
+                m_reconnect_max_delay = a_max_delay;
+            }
+
+            void disable_reconnect() {
+                m_reconnect = false;
+                m_reconnect_timer.cancel();
+            }
+
+            void start_async() {
+                m_running = true;
+                m_thread = std::thread(&net::run, this);
+            }
+
+            void stop_async() {
+                m_running = false;
+                boost::asio::post(m_context, []() {});
+
+                if (m_thread.joinable()) {
+                    m_thread.join();
+                }
+            }
+
+            void start_sync() {
+                m_running = true;
+                run();
+            }
+
+            void send() {
+                send_frame(get_buffer().data(), get_size());
+            }
+
+            void send(const message& a_message) {
+                send_frame(a_message.get_buffer().data(), a_message.get_size());
+            }
+
+            /// Queue a message to be sent from the io thread. Safe to call from any thread; build the message
+            /// with create_message() rather than start()/write_*(), which use the shared buffer.
+            void queue_send(message a_message) {
+                m_outbound.push(std::move(a_message));
+                schedule_flush();
+            }
+
+            /// Ask the server to deliver messages published to a topic.
+            void subscribe(std::string_view a_topic) {
+                auto request = create_message("NET_SUBSCRIBE");
+                request.write_string(a_topic);
+                send(request);
+            }
+
+            void unsubscribe(std::string_view a_topic) {
+                auto request = create_message("NET_UNSUBSCRIBE");
+                request.write_string(a_topic);
+                send(request);
+            }
+
+            /// Set the number of worker threads for offloaded handlers. Call before connecting.
+            void set_worker_threads(size_t a_count) {
+                m_serial.reset();
+                m_workers = std::make_unique<worker_pool>(a_count);
+            }
+
+            /// Set how long a call waits for its response. Zero disables the timeout.
+            void set_call_timeout(std::chrono::milliseconds a_timeout) {
+                m_call_timeout = a_timeout;
+            }
+
+            /// Call a remote procedure registered on the server with receive() and answered with create_reply().
+            /// Any number of calls may be in flight at once, and they may complete in any order.
+            template <typename... t_args>
+            rpc_call call(std::string_view a_id, const t_args&... a_args) {
+                auto promise = std::make_shared<std::promise<message>>();
+                auto future = promise->get_future();
+
+                auto call_id = begin_call(a_id, [promise](error_code a_ec, message a_response) {
+                    if (a_ec.failed()) {
+                        promise->set_exception(std::make_exception_ptr(boost::system::system_error(a_ec)));
+                    } else {
+                        promise->set_value(std::move(a_response));
+                    }
+                }, a_args...);
+
+                return rpc_call(call_id, std::move(future));
+            }
+
+            /// Receive stream bodies sent with server::net::send_file() or send_mapped() under the given ID.
+            /// a_open picks where the body goes once its length is known; a_complete runs when it has arrived.
+            void receive_stream(const std::string& a_id, stream_open_handler a_open, stream_complete_handler a_complete) {
+                m_stream_handlers[a_id] = { std::move(a_open), std::move(a_complete) };
+            }
+
+            /// Cancel an outstanding call. Its result fails with operation_aborted and a late response is ignored.
+            void cancel(const rpc_call& a_call) {
+                complete_call(a_call.get_id(), boost::asio::error::operation_aborted, {});
+            }
+
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+            /// Run a coroutine on the io thread.
+            void spawn(awaitable<void> a_coroutine) {
+                boost::asio::co_spawn(m_context, std::move(a_coroutine), boost::asio::detached);
+            }
+
+            /// Connect without blocking the io thread and wait for the schema handshake to finish.
+            /// Messages without a registered handler are then delivered to co_next_message().
+            awaitable<void> co_connect(std::string a_hostname, port_type a_port) {
+                auto endpoints = co_await m_resolver.async_resolve(a_hostname, std::to_string(a_port), boost::asio::use_awaitable);
+
+                socket tcp(m_context);
+                co_await boost::asio::async_connect(tcp, endpoints, boost::asio::use_awaitable);
+                m_socket = std::move(tcp);
+
+                m_coroutine = true;
+                m_target = { transport_kind::tcp, std::move(a_hostname), a_port, {} };
+                begin_session();
+
+                co_await m_handshakes.pop();
+            }
+
+            /// Wait for the next message without a registered handler. The read position is just past the message ID.
+            awaitable<message> co_next_message() {
+                return m_inbox.pop();
+            }
+
+            /// Send a message without blocking the io thread.
+            awaitable<void> co_send(message a_message) {
+                auto size = static_cast<frame_size>(a_message.get_size());
+
+                // Another write is in flight; queue behind it so the frames do not interleave.
+                if (m_writing) {
+                    m_deferred.emplace_back(a_message.get_buffer().data(), a_message.get_buffer().data() + size);
+                    co_return;
+                }
+
+                std::array<boost::asio::const_buffer, 2> buffers {
+                    boost::asio::buffer(&size, sizeof(size)),
+                    boost::asio::buffer(a_message.get_buffer().data(), size)
+                };
+
+                error_code ec;
+
+                m_writing = true;
+                co_await boost::asio::async_write(m_socket, buffers, boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+
+                if (ec.failed()) {
+                    m_writing = false;
+                    m_deferred.clear();
+                    throw boost::system::system_error(ec);
+                }
+
+                write_deferred();
+            }
+
+            /// Call a remote procedure and wait for its response without blocking the io thread.
+            template <typename... t_args>
+            awaitable<message> co_call(std::string a_id, t_args... a_args) {
+                auto result = std::make_shared<awaitable_queue<std::pair<error_code, message>>>();
+
+                begin_call(a_id, [result](error_code a_ec, message a_response) {
+                    result->push({ a_ec, std::move(a_response) });
+                }, a_args...);
+
+                auto [ec, response] = co_await result->pop();
+
+                if (ec.failed()) {
+                    throw boost::system::system_error(ec);
+                }
+
+                co_return response;
+            }
+#endif
+
+        private:
+            void begin_accept_message() {
+                boost::asio::async_read(
+                        m_socket,
+                        boost::asio::buffer(&m_frame_size, sizeof(m_frame_size)),
+                        [this](boost::system::error_code a_ec, std::size_t) {
+                            if (a_ec.failed() || m_frame_size < sizeof(size_t) || m_frame_size > get_buffer().size()) {
+                                handle_disconnect();
+                                return;
+                            }
+
+                            accept_frame();
+                        }
+                );
+            }
+
+            void accept_frame() {
+                boost::asio::async_read(
+                        m_socket,
+                        boost::asio::buffer(get_buffer().data(), m_frame_size),
+                        [this](boost::system::error_code a_ec, std::size_t a_bytes_transferred) {
+                            if (a_ec.failed()) {
+                                handle_disconnect();
+                                return;
+                            }
+
+                            if (auto* handler = find_offload_handler()) {
+                                offload(*handler, a_bytes_transferred);
+                            } else if (!deliver_to_coroutine(a_bytes_transferred)) {
+                                dispatch();
+                            }
+
+                            // A stream body resumes frame reads once it has been read.
+                            if (!m_streaming) {
+                                begin_accept_message();
+                            }
+                        }
+                );
+            }
+
+            void handle_disconnect() {
+                // Detected server disconnect or a malformed frame. A failed write and the read it aborts both get
+                // here; only the first counts.
+                if (!m_connected) {
+                    return;
+                }
+
+                error_code ec;
+                m_socket.close(ec);
+
+                m_connected = false;
+                dispatch_disconnect();
+
+                fail_calls(boost::asio::error::not_connected);
+
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+                m_inbox.close();
+#endif
+
+                schedule_reconnect();
+            }
+
+            /// Start talking over a newly connected m_socket. The server opens with the schema.
+            void begin_session() {
+                m_connected = true;
+                m_streaming = false;
+                m_reconnect_attempts = 0;
+
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+                // The last disconnect closed the inbox, and handshakes of earlier sessions were never waited on.
+                m_inbox.reopen();
+                m_handshakes.clear();
+#endif
+
+                dispatch_connect();
+
+                begin_accept_message();
+            }
+
+            /// Addresses raced by one async_connect().
+            struct connect_race {
+                explicit connect_race(io_context& a_context) : m_timer(a_context) {}
+
+                std::vector<boost::asio::ip::tcp::endpoint> m_endpoints; ///< Candidates, alternating address families.
+                std::vector<std::shared_ptr<socket>> m_attempts;         ///< One socket per started attempt.
+                boost::asio::steady_timer m_timer;                       ///< Starts the next attempt when the last one is slow.
+                size_t m_pending = 0;                                    ///< Attempts still in progress.
+                bool m_done = false;
+                error_code m_error;                                      ///< Failure of the most recent attempt.
+                std::function<void (error_code)> m_complete;
+            };
+
+            void start_connect(endpoint a_target, std::function<void (error_code)> a_complete) {
+                m_target = std::move(a_target);
+
+                auto complete = [this, a_complete = std::move(a_complete)](error_code a_ec) {
+                    if (a_ec.failed()) {
+                        schedule_reconnect();
+                    }
+
+                    if (a_complete) {
+                        a_complete(a_ec);
+                    }
+                };
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+                if (m_target.m_kind != transport_kind::tcp) {
+                    auto local = std::make_shared<local_socket>(m_context);
+
+                    local->async_connect(boost::asio::local::stream_protocol::endpoint(m_target.m_path), [this, local, complete](error_code a_ec) {
+                        if (a_ec.failed()) {
+                            complete(a_ec);
+                            return;
+                        }
+
+                        if (m_target.m_kind == transport_kind::shared_memory) {
+                            try {
+                                m_socket = shm_stream::open(std::move(*local));
+                            } catch (const std::exception&) {
+                                complete(boost::asio::error::connection_refused);
+                                return;
+                            }
+                        } else {
+                            m_socket = std::move(*local);
+                        }
+
+                        begin_session();
+                        complete({});
+                    });
+
+                    return;
+                }
+#endif
+
+                m_resolver.async_resolve(m_target.m_host, std::to_string(m_target.m_port), [this, complete](error_code a_ec, resolver::results_type a_results) {
+                    if (a_ec.failed()) {
+                        complete(a_ec);
+                        return;
+                    }
+
+                    auto race = std::make_shared<connect_race>(m_context);
+                    race->m_complete = complete;
+
+                    // Alternate address families, starting with the resolver's first choice.
+                    std::vector<boost::asio::ip::tcp::endpoint> preferred, other;
+
+                    for (const auto& entry : a_results) {
+                        auto& list = preferred.empty() || entry.endpoint().protocol() == preferred.front().protocol() ? preferred : other;
+                        list.push_back(entry.endpoint());
+                    }
+
+                    for (size_t i = 0; i < std::max(preferred.size(), other.size()); ++i) {
+                        if (i < preferred.size()) {
+                            race->m_endpoints.push_back(preferred[i]);
+                        }
+
+                        if (i < other.size()) {
+                            race->m_endpoints.push_back(other[i]);
+                        }
+                    }
+
+                    race->m_error = boost::asio::error::host_not_found;
+                    race_next(race);
+                });
+            }
+
+            /// Start the next candidate of a race, or finish it if none are left and none are in progress.
+            void race_next(std::shared_ptr<connect_race> a_race) {
+                if (a_race->m_done) {
+                    return;
+                }
+
+                auto index = a_race->m_attempts.size();
+
+                if (index == a_race->m_endpoints.size()) {
+                    if (a_race->m_pending == 0) {
+                        a_race->m_done = true;
+                        a_race->m_timer.cancel();
+                        a_race->m_complete(a_race->m_error);
+                    }
+
+                    return;
+                }
+
+                auto attempt = std::make_shared<socket>(m_context);
+                a_race->m_attempts.push_back(attempt);
+                ++a_race->m_pending;
+
+                attempt->async_connect(a_race->m_endpoints[index], [this, a_race, attempt](error_code a_ec) {
+                    --a_race->m_pending;
+
+                    if (a_race->m_done) {
+                        return;
+                    }
+
+                    if (a_ec.failed()) {
+                        a_race->m_error = a_ec;
+                        race_next(a_race);
+                        return;
+                    }
+
+                    a_race->m_done = true;
+                    a_race->m_timer.cancel();
+
+                    for (auto& other : a_race->m_attempts) {
+                        if (other != attempt) {
+                            error_code ec;
+                            other->close(ec);
+                        }
+                    }
+
+                    m_socket = std::move(*attempt);
+                    begin_session();
+                    a_race->m_complete({});
+                });
+
+                a_race->m_timer.expires_after(connection_attempt_delay);
+                a_race->m_timer.async_wait([this, a_race](error_code a_ec) {
+                    if (!a_ec.failed()) {
+                        race_next(a_race);
+                    }
+                });
+            }
+
+            /// Wait half the backoff plus a random part of the other half, then connect to m_target again.
+            void schedule_reconnect() {
+                if (!m_reconnect || m_reconnect_pending) {
+                    return;
+                }
+
+                auto shift = std::min(m_reconnect_attempts++, 16u);
+                auto ceiling = std::min(m_reconnect_max_delay, m_reconnect_initial_delay * (int64_t(1) << shift));
+                std::uniform_int_distribution<int64_t> jitter(0, ceiling.count() / 2);
+
+                m_reconnect_pending = true;
+                m_reconnect_timer.expires_after(ceiling - ceiling / 2 + std::chrono::milliseconds(jitter(m_random)));
+                m_reconnect_timer.async_wait([this](error_code a_ec) {
+                    m_reconnect_pending = false;
+
+                    if (!a_ec.failed() && m_reconnect && !m_connected) {
+                        start_connect(m_target, {});
+                    }
+                });
+            }
+
+            void begin_stream(const std::string& a_id, uint64_t a_length) {
+                m_streaming = true;
+
+                auto it = m_stream_handlers.find(a_id);
+                auto sink = std::make_shared<stream_sink>();
+
+                if (it != m_stream_handlers.cend()) {
+                    *sink = it->second.m_open(a_length);
+                }
+
+                // Set when the sink cannot be written; the body is then drained so the connection stays usable.
+                auto sink_ec = std::make_shared<error_code>();
+
+                // An empty body needs no read, and accept_frame() goes straight on to the next frame. Finishing
+                // through done() here would start a second read alongside that one.
+                if (a_length == 0) {
+                    m_streaming = false;
+
+                    if (!sink->m_path.empty() && !std::ofstream(sink->m_path, std::ios::binary | std::ios::trunc)) {
+                        *sink_ec = boost::system::errc::make_error_code(boost::system::errc::io_error);
+                    }
+
+                    if (it != m_stream_handlers.cend()) {
+                        it->second.m_complete(*sink, *sink_ec);
+                    }
+
+                    return;
+                }
+
+                auto done = [this, sink, sink_ec, handlers = it != m_stream_handlers.cend() ? &it->second : nullptr](error_code a_ec) {
+                    m_streaming = false;
+
+                    if (handlers) {
+                        handlers->m_complete(*sink, a_ec.failed() ? a_ec : *sink_ec);
+                    }
+
+                    if (a_ec.failed()) {
+                        handle_disconnect();
+                    } else {
+                        begin_accept_message();
+                    }
+                };
+
+                if (sink->m_buffer) {
+                    boost::asio::async_read(
+                        m_socket,
+                        boost::asio::buffer(sink->m_buffer, a_length),
+                        [done](error_code a_ec, std::size_t) {
+                            done(a_ec);
+                        }
+                    );
+
+                    return;
+                }
+
+                if (sink->m_path.empty()) {
+                    read_stream_chunks(nullptr, a_length, done);
+                    return;
+                }
+
+#if defined(__linux__)
+                if (!m_socket.is_shared_memory()) {
+                    auto target = std::make_shared<splice_target>();
+                    target->m_file = ::open(sink->m_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+                    if (target->m_file < 0 || ::pipe2(target->m_pipe, O_CLOEXEC) < 0) {
+                        *sink_ec = error_code(errno, boost::system::system_category());
+                        read_stream_chunks(nullptr, a_length, done);
+                        return;
+                    }
+
+                    target->m_remaining = a_length;
+                    splice_stream(target, done);
+                    return;
+                }
+#endif
+
+                auto file = std::make_shared<std::ofstream>(sink->m_path, std::ios::binary | std::ios::trunc);
+
+                if (!*file) {
+                    *sink_ec = boost::system::errc::make_error_code(boost::system::errc::io_error);
+                    file.reset();
+                }
+
+                read_stream_chunks(file, a_length, done);
+            }
+
+            /// Read a stream body through the frame buffer, optionally writing it to a file.
+            void read_stream_chunks(std::shared_ptr<std::ofstream> a_file, uint64_t a_remaining, std::function<void (error_code)> a_done) {
+                if (a_remaining == 0) {
+                    a_done({});
+                    return;
+                }
+
+                auto chunk = static_cast<size_t>(std::min<uint64_t>(a_remaining, get_buffer().size()));
+
+                boost::asio::async_read(
+                    m_socket,
+                    boost::asio::buffer(get_buffer().data(), chunk),
+                    [this, a_file, a_remaining, a_done](error_code a_ec, std::size_t a_bytes_transferred) {
+                        if (a_ec.failed()) {
+                            a_done(a_ec);
+                            return;
+                        }
+
+                        if (a_file) {
+                            a_file->write(reinterpret_cast<const char*>(get_buffer().data()), static_cast<std::streamsize>(a_bytes_transferred));
+                        }
+
+                        read_stream_chunks(a_file, a_remaining - a_bytes_transferred, a_done);
+                    }
+                );
+            }
+
+#if defined(__linux__)
+            /// File and pipe used to splice a stream body from the socket to disk without copying it to user space.
+            struct splice_target {
+                int m_file = -1;
+                int m_pipe[2] = { -1, -1 };
+                uint64_t m_remaining = 0;
+
+                ~splice_target() {
+                    for (int fd : { m_file, m_pipe[0], m_pipe[1] }) {
+                        if (fd >= 0) {
+                            ::close(fd);
+                        }
+                    }
+                }
+            };
+
+            void splice_stream(std::shared_ptr<splice_target> a_target, std::function<void (error_code)> a_done) {
+                if (a_target->m_remaining == 0) {
+                    a_done({});
+                    return;
+                }
+
+                m_socket.async_wait(socket::wait_read, [this, a_target, a_done](error_code a_ec) {
+                    if (a_ec.failed()) {
+                        a_done(a_ec);
+                        return;
+                    }
+
+                    auto chunk = static_cast<size_t>(std::min<uint64_t>(a_target->m_remaining, 65536));
+                    ssize_t spliced = ::splice(m_socket.native_handle(), nullptr, a_target->m_pipe[1], nullptr, chunk, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+                    if (spliced == 0) {
+                        a_done(boost::asio::error::eof);
+                        return;
+                    }
+
+                    if (spliced < 0) {
+                        if (errno == EAGAIN || errno == EINTR) {
+                            splice_stream(a_target, a_done);
+                        } else {
+                            a_done(error_code(errno, boost::system::system_category()));
+                        }
+
+                        return;
+                    }
+
+                    for (ssize_t left = spliced; left > 0;) {
+                        ssize_t written = ::splice(a_target->m_pipe[0], nullptr, a_target->m_file, nullptr, static_cast<size_t>(left), SPLICE_F_MOVE);
+
+                        if (written < 0 && errno == EINTR) {
+                            continue;
+                        }
+
+                        if (written <= 0) {
+                            a_done(error_code(errno, boost::system::system_category()));
+                            return;
+                        }
+
+                        left -= written;
+                    }
+
+                    a_target->m_remaining -= spliced;
+                    splice_stream(a_target, a_done);
+                });
+            }
+#endif
+
+            template <typename... t_args>
+            uint32_t begin_call(std::string_view a_id, std::function<void (error_code, message)> a_complete, const t_args&... a_args) {
+                auto request = create_message(a_id);
+                auto call_id = ++m_call_counter;
+
+                request.write_call_id(call_id);
+                request.write_values(a_args...);
+
+                pending_call pending { std::move(a_complete), nullptr };
+
+                if (m_call_timeout.count() > 0) {
+                    pending.m_timer = std::make_shared<boost::asio::steady_timer>(m_context, m_call_timeout);
+                    pending.m_timer->async_wait([this, call_id](error_code a_ec) {
+                        if (a_ec != boost::asio::error::operation_aborted) {
+                            complete_call(call_id, boost::asio::error::timed_out, {});
+                        }
+                    });
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(m_calls_guard);
+                    m_calls.emplace(call_id, std::move(pending));
+                }
+
+                // Off the io thread the request goes through the outbound queue; a failed write then
+                // surfaces as a disconnect or timeout.
+                if (!m_context.get_executor().running_in_this_thread()) {
+                    queue_send(std::move(request));
+                    return call_id;
+                }
+
+                try {
+                    send(request);
+                } catch (const boost::system::system_error& e) {
+                    complete_call(call_id, e.code(), {});
+                }
+
+                return call_id;
+            }
+
+            /// Finish a call, unless it already completed, timed out or was cancelled.
+            void complete_call(uint32_t a_call_id, error_code a_ec, message a_response) {
+                pending_call pending;
+
+                {
+                    std::lock_guard<std::mutex> lock(m_calls_guard);
+
+                    auto it = m_calls.find(a_call_id);
+
+                    if (it == m_calls.cend()) {
+                        return;
+                    }
+
+                    pending = std::move(it->second);
+                    m_calls.erase(it);
+                }
+
+                if (pending.m_timer) {
+                    pending.m_timer->cancel();
+                }
+
+                pending.m_complete(a_ec, std::move(a_response));
+            }
+
+            void fail_calls(error_code a_ec) {
+                std::vector<uint32_t> call_ids;
+
+                {
+                    std::lock_guard<std::mutex> lock(m_calls_guard);
+
+                    for (auto& entry : m_calls) {
+                        call_ids.push_back(entry.first);
+                    }
+                }
+
+                for (auto call_id : call_ids) {
+                    complete_call(call_id, a_ec, {});
+                }
+            }
+
+            void offload(offload_handler& a_handler, size_t a_size) {
+                if (!m_workers) {
+                    m_workers = std::make_unique<worker_pool>(std::max(1u, std::thread::hardware_concurrency()));
+                }
+
+                if (!m_serial) {
+                    m_serial.emplace(m_workers->make_serial_queue());
+                }
+
+                boost::asio::post(*m_serial, [&a_handler, msg = message(get_buffer().data(), a_size)]() mutable {
+                    msg.read_id();
+                    a_handler(msg);
+                });
+            }
+
+            /// Hand an unhandled message to a coroutine waiting in co_next_message().
+            bool deliver_to_coroutine(size_t a_size) {
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+                if (m_coroutine && !is_handled()) {
+                    message msg(get_buffer().data(), a_size);
+                    msg.read_id();
+                    m_inbox.push(std::move(msg));
+                    return true;
+                }
+#else
+                static_cast<void>(a_size);
+#endif
+
+                return false;
+            }
+
+            void send_frame(const uint8_t* a_data, size_t a_size) {
+                if (m_writing) {
+                    m_deferred.emplace_back(a_data, a_data + a_size);
+                    return;
+                }
+
+                write_frame(m_socket, a_data, a_size);
+            }
+
+            /// Write the frames sent during co_send() with one gathered async write, repeating until none are left.
+            void write_deferred() {
+                m_writing = false;
+                m_in_flight.clear();
+
+                if (m_deferred.empty()) {
+                    return;
+                }
+
+                m_in_flight.swap(m_deferred);
+
+                std::vector<boost::asio::const_buffer> buffers;
+                buffers.reserve(m_in_flight.size() * 2);
+
+                // Reserved up front, since the buffers point into it.
+                m_in_flight_sizes.clear();
+                m_in_flight_sizes.reserve(m_in_flight.size());
+
+                for (auto& frame : m_in_flight) {
+                    m_in_flight_sizes.push_back(static_cast<frame_size>(frame.size()));
+                    buffers.push_back(boost::asio::buffer(&m_in_flight_sizes.back(), sizeof(frame_size)));
+                    buffers.push_back(boost::asio::buffer(frame));
+                }
+
+                m_writing = true;
+                boost::asio::async_write(m_socket, buffers, [this](error_code a_ec, std::size_t) {
+                    if (a_ec.failed()) {
+                        m_writing = false;
+                        m_in_flight.clear();
+                        m_deferred.clear();
+
+                        handle_disconnect();
+                        return;
+                    }
+
+                    write_deferred();
+                });
+            }
+
+            /// Post one flush for any number of queue_send() calls made before it runs.
+            void schedule_flush() {
+                if (!m_flush_scheduled.exchange(true)) {
+                    boost::asio::post(m_context, [this]() {
+                        m_flush_scheduled = false;
+                        flush_outbound();
+                    });
+                }
+            }
+
+            /// Send everything queued by other threads in one gathered write.
+            void flush_outbound() {
+                message msg;
+
+                while (m_outbound.pop(msg)) {
+                    m_flush_batch.push_back(std::move(msg));
+                }
+
+                if (m_flush_batch.empty()) {
+                    return;
+                }
+
+                if (m_writing) {
+                    for (auto& queued : m_flush_batch) {
+                        m_deferred.emplace_back(queued.get_buffer().data(), queued.get_buffer().data() + queued.get_size());
+                    }
+
+                    m_flush_batch.clear();
+                    return;
+                }
+
+                std::vector<const message*> messages;
+
+                for (auto& queued : m_flush_batch) {
+                    messages.push_back(&queued);
+                }
+
+                error_code ec;
+                write_frames(m_socket, messages, ec);
+
+                m_flush_batch.clear();
+
+                if (ec.failed()) {
+                    handle_disconnect();
+                }
+            }
+
+            /// Sleeps while there is nothing to do; queue_send() and stop_async() post work to wake it.
+            void run() {
+                auto work = boost::asio::make_work_guard(m_context);
+
+                while (m_running) {
+                    m_context.run_one();
+                }
+            }
+        };
+    }
+
+    namespace server {
+        class net;
+
+        class client : public std::enable_shared_from_this<client> {
+            friend class net;
+
+            transport m_socket;
+            size_t m_id;
+            net* m_net = nullptr; ///< Net that accepted the client, whose write lane co_send() uses.
+
+            std::vector<uint8_t> m_receive_buffer; ///< Frame being read from this client.
+            frame_size m_frame_size = 0;           ///< Size of the frame being read.
+
+#if defined(SR_NET_IO_URING)
+            std::shared_ptr<registered_buffer_pool> m_pool;     ///< Pool m_slot was taken from, if any. Shared, since a client can outlive its net.
+            size_t m_slot = registered_buffer_pool::npos;       ///< Registered receive buffer used instead of m_receive_buffer.
+#endif
+
+            std::shared_ptr<capture_log> m_capture; ///< Capture shared with the net, if one is running.
+            std::vector<std::string> m_topics;      ///< Topics this client is subscribed to.
+
+            token_bucket m_message_bucket;                           ///< Inbound message budget.
+            token_bucket m_byte_bucket;                              ///< Inbound byte budget.
+            std::unordered_map<size_t, token_bucket> m_id_buckets;   ///< Inbound budgets for rate-limited message IDs.
+            std::optional<boost::asio::steady_timer> m_resume;       ///< Resumes reading after a throttle pause.
+            uint64_t m_rejected = 0;                                 ///< Messages dropped or refused for exceeding limits.
+            uint64_t m_throttled = 0;                                ///< Times reading was paused for exceeding limits.
+            bool m_ready = false;                                    ///< Whether NET_SIGNAL_READY has arrived.
+
+            std::vector<std::vector<uint8_t>> m_conflated;           ///< Latest unsent frame per conflation key, in first-queued order.
+            std::map<std::pair<size_t, uint64_t>, size_t> m_conflated_index; ///< Position in m_conflated by message ID and key.
+            bool m_awaiting_writable = false;                        ///< Whether m_conflated is waiting for the socket to take more.
+            /// Send made while an async write owned the socket: a frame, or the start of a stream body.
+            struct deferred_write {
+                std::vector<uint8_t> m_frame;
+                std::function<void (const std::shared_ptr<client>&)> m_start; ///< Starts a body write; set instead of m_frame.
+            };
+
+            bool m_writing = false;                                  ///< Whether an async write owns the socket. Other sends go to m_deferred meanwhile.
+            std::deque<deferred_write> m_deferred;                   ///< Sends made while m_writing, written in order once it completes.
+            std::vector<std::vector<uint8_t>> m_in_flight;           ///< Frames of the async write in progress.
+            std::vector<frame_size> m_in_flight_sizes;               ///< Length prefixes of m_in_flight.
+
+            std::optional<worker_pool::serial_queue> m_serial; ///< Keeps offloaded handlers for this client in arrival order.
+
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+            awaitable_queue<message> m_inbox; ///< Messages without a handler, for co_next_message().
+            bool m_coroutine = false;          ///< Whether the client was handed out by net::co_accept().
+#endif
+
+        public:
+            client(transport a_socket, size_t a_id) : m_socket(std::move(a_socket)), m_id(a_id) {}
+
+            client(const client&) = delete;
+            client& operator = (const client&) = delete;
+
+            ~client() {
+#if defined(SR_NET_IO_URING)
+                // Released here rather than on disconnect, so no read still in flight can target a reused slot.
+                if (m_pool && m_slot != registered_buffer_pool::npos) {
+                    m_pool->release(m_slot);
+                }
+#endif
+            }
+
+            /// Start of the frame being read from this client.
+            [[nodiscard]] uint8_t* get_receive_data() {
+#if defined(SR_NET_IO_URING)
+                if (m_slot != registered_buffer_pool::npos) {
+                    return static_cast<uint8_t*>(m_pool->at(m_slot).data());
+                }
+#endif
+
+                return m_receive_buffer.data();
+            }
+
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+            /// Wait for the next message without a registered handler. The read position is just past the message ID.
+            awaitable<message> co_next_message() {
+                return m_inbox.pop();
+            }
+
+            /// Send a message without blocking the io thread. It is ordered with the client's other sends.
+            awaitable<void> co_send(message a_message);
+#endif
+
+            [[nodiscard]] uint64_t get_rejected_count() const {
+                return m_rejected;
+            }
+
+            [[nodiscard]] uint64_t get_throttled_count() const {
+                return m_throttled;
+            }
+
+            [[nodiscard]] bool operator == (const client& a_rhs) const noexcept {
+                return m_id == a_rhs.m_id;
+            }
+        };
+
+        SR_DISPATCHER(connect, client&);
+        SR_DISPATCHER(disconnect, client&);
+        SR_DISPATCHER(message, client&);
+        SR_DISPATCHER(ready, client&);
+
+        class net :
+            public net_interface<client&>,
+            public connect_dispatcher,
+            public disconnect_dispatcher,
+            public message_dispatcher,
+            public ready_dispatcher
+        {
+            io_context m_context;
+            std::unique_ptr<acceptor> m_acceptor;
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+            std::unique_ptr<local_acceptor> m_local_acceptor; ///< Acceptor for unix:// and shm:// endpoints.
+            bool m_shared_memory = false;                     ///< Whether local connections are moved to shared memory.
+#endif
+
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+            awaitable_queue<std::shared_ptr<client>> m_accepted; ///< Ready clients waiting to be taken by co_accept().
+            bool m_coroutine_accept = false;                     ///< Whether co_accept() has been used.
+#endif
+
+            std::thread m_thread; ///< Thead to manage incoming connections and messages.
+            std::atomic<bool> m_running; ///< Control boolean for thread.
+
+            /// Message queued from another thread, with its recipients.
+            struct outbound_message {
+                std::shared_ptr<client> m_client; ///< Recipient, if sent to one client.
+                std::string m_topic;              ///< Topic to publish to if there is no m_client. Empty broadcasts to every client.
+                message m_message;
+            };
+
+            mpsc_queue<outbound_message> m_outbound;                ///< Messages queued by other threads, sent from the io thread.
+            std::atomic<bool> m_flush_scheduled = false;            ///< Whether a flush of m_outbound is already posted.
+            std::vector<outbound_message> m_flush_messages;         ///< Messages taken from m_outbound for the current flush.
+            std::vector<std::pair<client*, const message*>> m_flush_batch; ///< One entry per recipient of m_flush_messages.
+            std::unique_ptr<worker_pool> m_workers;                              ///< Pool for offloaded handlers. Created on demand.
+
+            std::shared_ptr<capture_log> m_capture; ///< Log of all received and sent frames, if capturing.
+            bool m_replaying = false;               ///< Whether replay() is feeding frames; sends are dropped.
+
+#if defined(SR_NET_IO_URING)
+            std::shared_ptr<registered_buffer_pool> m_receive_pool; ///< Registered receive buffers handed to new clients.
+#endif
+
+            std::vector<std::shared_ptr<client>> m_clients; ///< List of all connected clients.
+            std::mutex m_clients_guard;                     ///< Guard to synchronize changes to client list.
+
+            size_t m_id_counter = 0; ///< Current counter for assigning connection IDs. Increments on each new connection.
+
+            std::unordered_map<std::string, std::vector<std::shared_ptr<client>>> m_topics; ///< Subscribers by topic.
+
+            admission_policy m_admission;                         ///< Limits on every client's inbound messages.
+            std::unordered_map<size_t, rate_limit> m_id_limits;   ///< Per-client limits for individual message IDs.
+            uint64_t m_rejected = 0;                              ///< Messages dropped or refused across all clients.
+            uint64_t m_throttled = 0;                             ///< Throttle pauses across all clients.
+
+        public:
+            net() : m_context(), m_running(false), m_acceptor() {
+                set_buffer_size(8192);
+
+                add_builtin_network_strings();
+
+                receive("NET_SUBSCRIBE", [this](client& a_client) {
+                    auto topic = read_string();
+
+                    // Every topic costs memory, so a client may only hold so many.
+                    if (m_admission.m_max_topics != 0 && a_client.m_topics.size() >= m_admission.m_max_topics) {
+                        ++a_client.m_rejected;
+                        ++m_rejected;
+
+                        if (m_admission.m_policy == limit_policy::disconnect) {
+                            disconnect(a_client);
+                        }
+
+                        return;
+                    }
+
+                    subscribe(a_client, topic);
+                });
+
+                receive("NET_UNSUBSCRIBE", [this](client& a_client) {
+                    unsubscribe(a_client, read_string());
+                });
+
+                receive("NET_SIGNAL_READY", [this](client& a_client) {
+                    // Sent once per connection; a repeat would hand the client out twice.
+                    if (a_client.m_ready) {
+                        return;
+                    }
+
+                    a_client.m_ready = true;
+                    dispatch_ready(a_client);
+
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+                    if (m_coroutine_accept) {
+                        a_client.m_coroutine = true;
+                        m_accepted.push(a_client.shared_from_this());
+                    }
+#endif
+                });
+            }
+
+            ~net() {
+                stop_async();
+
+                // Pending handlers hold clients, whose strands and receive buffers belong to m_workers and
+                // m_receive_pool. Let them run to completion while both still exist, since m_context goes last.
+                if (m_workers) {
+                    m_workers->join();
+                }
+
+                error_code ec;
+
+                if (m_acceptor) {
+                    m_acceptor->close(ec);
+                }
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+                if (m_local_acceptor) {
+                    m_local_acceptor->close(ec);
+                }
+#endif
+
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+                m_accepted.close();
+#endif
+
+                for (auto& cl : std::vector<std::shared_ptr<client>>(m_clients)) {
+                    disconnect(*cl);
+                }
+
+                m_context.restart();
+                m_context.poll();
+
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+                m_accepted.clear();
+#endif
+
+                outbound_message entry;
+
+                while (m_outbound.pop(entry)) {}
+
+                m_flush_messages.clear();
+
+#if defined(SR_NET_IO_URING)
+                if (m_receive_pool) {
+                    m_receive_pool->unregister();
+                }
+#endif
+            }
+
+            void open(port_type a_port) {
+                m_acceptor = std::make_unique<acceptor>(
+                    m_context,
+                    boost::asio::ip::tcp::endpoint(
+                        boost::asio::ip::tcp::v4(),
+                        a_port
+                    )
+                );
+
+                begin_accept();
+            }
+
+            /// Listen on an endpoint string (see endpoint::parse()).
+            void open(const std::string& a_endpoint) {
+                auto target = endpoint::parse(a_endpoint);
+
+                if (target.m_kind == transport_kind::tcp) {
+                    resolver lookup(m_context);
+                    auto address = target.m_host.empty() ? boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), target.m_port)
+                                                         : lookup.resolve(target.m_host, std::to_string(target.m_port))->endpoint();
+
+                    m_acceptor = std::make_unique<acceptor>(m_context, address);
+                    begin_accept();
+                    return;
+                }
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+                // Remove a socket file left behind by an earlier run.
+                std::error_code ec;
+                std::filesystem::remove(target.m_path, ec);
+
+                m_local_acceptor = std::make_unique<local_acceptor>(m_context, boost::asio::local::stream_protocol::endpoint(target.m_path));
+                m_shared_memory = target.m_kind == transport_kind::shared_memory;
+
+                begin_accept_local();
+#endif
+            }
+
+            void start_async() {
+                m_running = true;
+                m_thread = std::thread(&net::run, this);
+            }
+
+            void stop_async() {
+                m_running = false;
+                boost::asio::post(m_context, []() {});
+
+                if (m_thread.joinable()) {
+                    m_thread.join();
+                }
+            }
+
+            void start_sync() {
+                m_running = true;
+                run();
+            }
+
+            void poll() {
+                m_context.poll();
+                flush_outbound();
+            }
+
+            auto& get_clients() {
+                return m_clients;
+            }
+
+            auto find_client_by_id(size_t a_id) {
                 return std::find_if(m_clients.begin(), m_clients.end(), [a_id](const auto& element) -> bool {
                     return element->m_id == a_id;
                 });
             }
 
-            void disconnect(client& a_client) {
+            void disconnect(client& a_client) {
+                error_code ec;
+                a_client.m_socket.close(ec);
+
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+                a_client.m_inbox.close();
+#endif
+
+                if (a_client.m_resume) {
+                    a_client.m_resume->cancel();
+                }
+
+                while (!a_client.m_topics.empty()) {
+                    unsubscribe(a_client, std::string(a_client.m_topics.back()));
+                }
+
+                auto it = find_client_by_id(a_client.m_id);
+
+                if (it != m_clients.cend()) {
+                    m_clients.erase(it);
+                }
+            }
+
+            void send(client& a_client) {
+                send_frame(a_client, get_buffer().data(), get_size());
+            }
+
+            void send(client& a_client, const message& a_message) {
+                send_frame(a_client, a_message.get_buffer().data(), a_message.get_size());
+            }
+
+            /// Send the message in the buffer once the client's socket can take it, replacing any unsent message with
+            /// the same ID and key. A slow client then gets the newest value per key instead of a backlog.
+            /// Conflated messages are written asynchronously and are not ordered against other sends.
+            void send_latest(client& a_client, uint64_t a_key) {
+                queue_latest(a_client, a_key, get_buffer().data(), get_size());
+            }
+
+            void send_latest(client& a_client, uint64_t a_key, const message& a_message) {
+                queue_latest(a_client, a_key, a_message.get_buffer().data(), a_message.get_size());
+            }
+
+            /// Conflated publish() (see send_latest()). Returns the number of subscribers.
+            size_t publish_latest(const std::string& a_topic, uint64_t a_key) {
+                auto topic = m_topics.find(a_topic);
+
+                if (topic == m_topics.cend()) {
+                    return 0;
+                }
+
+                for (auto& subscriber : topic->second) {
+                    queue_latest(*subscriber, a_key, get_buffer().data(), get_size());
+                }
+
+                return topic->second.size();
+            }
+
+            /// Set the limits on inbound messages from each client. Call from the io thread or before opening.
+            void set_admission_policy(const admission_policy& a_policy) {
+                m_admission = a_policy;
+            }
+
+            /// Limit how often each client may send one message ID. Follows the admission policy's limit_policy.
+            void set_message_rate_limit(std::string_view a_id, const rate_limit& a_limit) {
+                auto it = m_message_id_map.find(a_id);
+
+                if (it == m_message_id_map.cend()) {
+                    throw std::invalid_argument("unknown message ID");
+                }
+
+                m_id_limits[it->second] = a_limit;
+            }
+
+            [[nodiscard]] uint64_t get_rejected_count() const {
+                return m_rejected;
+            }
+
+            [[nodiscard]] uint64_t get_throttled_count() const {
+                return m_throttled;
+            }
+
+            /// Add a client to a topic. Clients can also subscribe themselves with client::net::subscribe().
+            void subscribe(client& a_client, const std::string& a_topic) {
+                if (std::find(a_client.m_topics.begin(), a_client.m_topics.end(), a_topic) != a_client.m_topics.cend()) {
+                    return;
+                }
+
+                a_client.m_topics.push_back(a_topic);
+                m_topics[a_topic].push_back(a_client.shared_from_this());
+            }
+
+            void unsubscribe(client& a_client, const std::string& a_topic) {
+                auto own = std::find(a_client.m_topics.begin(), a_client.m_topics.end(), a_topic);
+
+                if (own == a_client.m_topics.cend()) {
+                    return;
+                }
+
+                *own = std::move(a_client.m_topics.back());
+                a_client.m_topics.pop_back();
+
+                auto topic = m_topics.find(a_topic);
+                auto& subscribers = topic->second;
+
+                // Order does not matter, so swap with the last subscriber to keep the set compact.
+                auto it = std::find_if(subscribers.begin(), subscribers.end(), [&a_client](const auto& a_subscriber) {
+                    return a_subscriber.get() == &a_client;
+                });
+
+                *it = std::move(subscribers.back());
+                subscribers.pop_back();
+
+                if (subscribers.empty()) {
+                    m_topics.erase(topic);
+                }
+            }
+
+            /// Send the message in the buffer to every subscriber of a topic. Subscribers that cannot be written to are
+            /// disconnected. Returns the number of subscribers it was sent to.
+            size_t publish(const std::string& a_topic) {
+                return publish_frame(a_topic, get_buffer().data(), get_size());
+            }
+
+            size_t publish(const std::string& a_topic, const message& a_message) {
+                return publish_frame(a_topic, a_message.get_buffer().data(), a_message.get_size());
+            }
+
+            [[nodiscard]] size_t subscriber_count(const std::string& a_topic) const {
+                auto it = m_topics.find(a_topic);
+                return it == m_topics.cend() ? 0 : it->second.size();
+            }
+
+            /// Register receive buffers for up to a_count clients with io_uring. Clients beyond that use ordinary
+            /// buffers. Only has an effect when built with SR_NET_IO_URING. Call before open().
+            void set_registered_receive_buffers(size_t a_count) {
+#if defined(SR_NET_IO_URING)
+                // io_uring allows one registration at a time, so drop the old one before registering again.
+                if (m_receive_pool) {
+                    m_receive_pool->unregister();
+                }
+
+                m_receive_pool = std::make_shared<registered_buffer_pool>(m_context, a_count, get_buffer().size());
+#else
+                static_cast<void>(a_count);
+#endif
+            }
+
+            /// Send part of a file as a stream under the given ID (see client::net::receive_stream()).
+            /// On Linux the body goes from the file to the socket with sendfile(), without passing through user space.
+            /// The body is written asynchronously and later sends to the client follow it. Throws if the file cannot
+            /// be opened, before anything is sent; if the body cannot be sent in full, the client is disconnected.
+            void send_file(client& a_client, std::string_view a_id, const std::string& a_path, uint64_t a_offset = 0, uint64_t a_length = UINT64_MAX) {
+                if (m_replaying) {
+                    return;
+                }
+
+                auto file_size = std::filesystem::file_size(a_path);
+
+                if (a_offset > file_size) {
+                    throw std::out_of_range("offset is past the end of the file");
+                }
+
+                a_length = std::min(a_length, file_size - a_offset);
+
+#if defined(__linux__)
+                if (!a_client.m_socket.is_shared_memory()) {
+                    auto source = std::make_shared<sendfile_source>();
+                    source->m_file = ::open(a_path.c_str(), O_RDONLY | O_CLOEXEC);
+
+                    if (source->m_file < 0) {
+                        throw boost::system::system_error(error_code(errno, boost::system::system_category()));
+                    }
+
+                    source->m_offset = static_cast<off_t>(a_offset);
+                    source->m_remaining = a_length;
+
+                    send_stream_header(a_client, a_id, a_length);
+                    write_body(a_client, [this, source](const std::shared_ptr<client>& a_cl) {
+                        sendfile_body(a_cl, source);
+                    });
+                    return;
+                }
+#endif
+
+                auto file = std::make_shared<std::ifstream>(a_path, std::ios::binary);
+
+                if (!file->seekg(static_cast<std::streamoff>(a_offset))) {
+                    throw boost::system::system_error(boost::system::errc::make_error_code(boost::system::errc::io_error));
+                }
+
+                send_stream_header(a_client, a_id, a_length);
+                write_body(a_client, [this, file, a_length](const std::shared_ptr<client>& a_cl) {
+                    write_file_chunks(a_cl, file, std::make_shared<std::vector<char>>(64 * 1024), a_length);
+                });
+            }
+
+            /// Body of send_file() for shared memory, read through a buffer.
+            void write_file_chunks(std::shared_ptr<client> a_client, std::shared_ptr<std::ifstream> a_file, std::shared_ptr<std::vector<char>> a_chunk, uint64_t a_remaining) {
+                if (a_remaining == 0) {
+                    continue_writing(*a_client);
+                    return;
+                }
+
+                auto size = static_cast<size_t>(std::min<uint64_t>(a_remaining, a_chunk->size()));
+
+                // A short read means the file shrank after the header promised the length.
+                if (!a_file->read(a_chunk->data(), static_cast<std::streamsize>(size))) {
+                    fail_write(*a_client);
+                    return;
+                }
+
+                boost::asio::async_write(
+                    a_client->m_socket,
+                    boost::asio::buffer(a_chunk->data(), size),
+                    [this, a_client, a_file, a_chunk, a_remaining](error_code a_ec, std::size_t a_bytes_transferred) {
+                        if (a_ec.failed()) {
+                            fail_write(*a_client);
+                            return;
+                        }
+
+                        write_file_chunks(a_client, a_file, a_chunk, a_remaining - a_bytes_transferred);
+                    }
+                );
+            }
+
+#if defined(__linux__)
+            /// File being sent with sendfile() by send_file().
+            struct sendfile_source {
+                int m_file = -1;
+                off_t m_offset = 0;
+                uint64_t m_remaining = 0;
+
+                ~sendfile_source() {
+                    if (m_file >= 0) {
+                        ::close(m_file);
+                    }
+                }
+            };
+
+            /// Body of send_file() for descriptor-backed transports. Waits for the socket without blocking the io thread.
+            void sendfile_body(std::shared_ptr<client> a_client, std::shared_ptr<sendfile_source> a_source) {
+                while (a_source->m_remaining > 0) {
+                    ssize_t sent = ::sendfile(a_client->m_socket.native_handle(), a_source->m_file, &a_source->m_offset, static_cast<size_t>(a_source->m_remaining));
+
+                    if (sent < 0 && errno == EINTR) {
+                        continue;
+                    }
+
+                    if (sent < 0 && errno == EAGAIN) {
+                        // Asio keeps the socket non-blocking; carry on once it can take more.
+                        a_client->m_socket.async_wait(socket::wait_write, [this, a_client, a_source](error_code a_ec) {
+                            if (a_ec.failed()) {
+                                fail_write(*a_client);
+                                return;
+                            }
+
+                            sendfile_body(a_client, a_source);
+                        });
+                        return;
+                    }
+
+                    // An error, or the file shrank after the header promised the length.
+                    if (sent <= 0) {
+                        fail_write(*a_client);
+                        return;
+                    }
+
+                    a_source->m_remaining -= static_cast<uint64_t>(sent);
+                }
+
+                continue_writing(*a_client);
+            }
+#endif
+
+            /// Send a memory-mapped region as a stream under the given ID. The kernel reads the body
+            /// straight from the mapped pages. The body is written asynchronously, so the region is kept alive
+            /// until it has been sent.
+            void send_mapped(client& a_client, std::string_view a_id, std::shared_ptr<const boost::interprocess::mapped_region> a_region) {
+                if (m_replaying) {
+                    return;
+                }
+
+                send_stream_header(a_client, a_id, a_region->get_size());
+                write_body(a_client, [this, a_region](const std::shared_ptr<client>& a_cl) {
+                    boost::asio::async_write(
+                        a_cl->m_socket,
+                        boost::asio::buffer(a_region->get_address(), a_region->get_size()),
+                        [this, a_cl, a_region](error_code a_ec, std::size_t) {
+                            if (a_ec.failed()) {
+                                fail_write(*a_cl);
+                                return;
+                            }
+
+                            continue_writing(*a_cl);
+                        }
+                    );
+                });
+            }
+
+            /// Append every received and sent frame to a memory-mapped capture file.
+            /// Call from the io thread or while it is stopped.
+            void start_capture(const std::string& a_path) {
+                m_capture = std::make_shared<capture_log>(a_path);
+
+                for (auto& cl : m_clients) {
+                    cl->m_capture = m_capture;
+                }
+            }
+
+            void stop_capture() {
+                for (auto& cl : m_clients) {
+                    cl->m_capture.reset();
+                }
+
+                m_capture.reset();
+            }
+
+            /// Feed the received frames of a capture through the registered handlers without sockets,
+            /// either as fast as possible or at the recorded pace. Messages sent by handlers are dropped.
+            /// Call while the io thread is stopped. Returns the number of frames handled.
+            size_t replay(const std::string& a_path, bool a_recorded_speed = false) {
+                capture_reader reader(a_path);
+                std::unordered_map<uint64_t, std::shared_ptr<client>> clients;
+
+                capture_record record {};
+                const uint8_t* payload = nullptr;
+
+                size_t count = 0;
+                uint64_t first_time = 0;
+                auto start_time = std::chrono::steady_clock::now();
+
+                m_replaying = true;
+
+                while (reader.next(record, payload)) {
+                    if (record.m_direction != capture_direction::received || record.m_size < sizeof(size_t) || record.m_size > get_buffer().size()) {
+                        continue;
+                    }
+
+                    if (a_recorded_speed) {
+                        if (count == 0) {
+                            first_time = record.m_time;
+                        }
+
+                        // Captures from older builds were stamped with the system clock, which can step backwards.
+                        auto offset = record.m_time > first_time ? record.m_time - first_time : 0;
+                        std::this_thread::sleep_until(start_time + std::chrono::nanoseconds(offset));
+                    }
+
+                    auto& cl = clients[record.m_client_id];
+
+                    if (!cl) {
+                        cl = std::make_shared<client>(socket(m_context), record.m_client_id);
+                        cl->m_net = this;
+                    }
+
+                    std::memcpy(get_buffer().data(), payload, record.m_size);
+                    handle_frame(*cl, record.m_size);
+
+                    ++count;
+                }
+
+                m_replaying = false;
+
+                // Replayed NET_SUBSCRIBE frames put the stand-in clients into the live topics.
+                for (auto& entry : clients) {
+                    while (!entry.second->m_topics.empty()) {
+                        unsubscribe(*entry.second, std::string(entry.second->m_topics.back()));
+                    }
+                }
+
+                return count;
+            }
+
+            /// Queue a message to be sent from the io thread. Safe to call from any thread; build the message
+            /// with create_message() rather than start()/write_*(), which use the shared buffer.
+            void queue_send(client& a_client, message a_message) {
+                m_outbound.push({ a_client.shared_from_this(), {}, std::move(a_message) });
+                schedule_flush();
+            }
+
+            /// Queue a message for every connected client. Safe to call from any thread.
+            void queue_broadcast(message a_message) {
+                m_outbound.push({ nullptr, {}, std::move(a_message) });
+                schedule_flush();
+            }
+
+            /// Queue a message for every subscriber of a topic (see publish()). Safe to call from any thread.
+            void queue_publish(std::string a_topic, message a_message) {
+                if (a_topic.empty()) {
+                    throw std::invalid_argument("topic must not be empty");
+                }
+
+                m_outbound.push({ nullptr, std::move(a_topic), std::move(a_message) });
+                schedule_flush();
+            }
+
+            /// Set the number of worker threads for offloaded handlers. Call before opening.
+            void set_worker_threads(size_t a_count) {
+                m_workers = std::make_unique<worker_pool>(a_count);
+            }
+
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+            /// Run a coroutine on the io thread.
+            void spawn(awaitable<void> a_coroutine) {
+                boost::asio::co_spawn(m_context, std::move(a_coroutine), boost::asio::detached);
+            }
+
+            /// Wait for the next client to connect and finish the schema handshake.
+            /// Messages from that client without a registered handler are delivered to client::co_next_message().
+            /// Send a message to a client without blocking the io thread (see client::co_send()). If another write to
+            /// the client is in flight, the message is queued behind it and this returns at once.
+            awaitable<void> co_send(client& a_client, message a_message) {
+                if (m_replaying) {
+                    co_return;
+                }
+
+                auto size = static_cast<frame_size>(a_message.get_size());
+
+                if (m_capture) {
+                    m_capture->append(capture_direction::sent, a_client.m_id, a_message.get_buffer().data(), size);
+                }
+
+                if (a_client.m_writing) {
+                    defer_frame(a_client, a_message.get_buffer().data(), size);
+                    co_return;
+                }
+
+                std::array<boost::asio::const_buffer, 2> buffers {
+                    boost::asio::buffer(&size, sizeof(size)),
+                    boost::asio::buffer(a_message.get_buffer().data(), size)
+                };
+
+                auto cl = a_client.shared_from_this();
                 error_code ec;
-                a_client.m_socket.close(ec);
 
-                auto it = find_client_by_id(a_client.m_id);
+                cl->m_writing = true;
+                co_await boost::asio::async_write(cl->m_socket, buffers, boost::asio::redirect_error(boost::asio::use_awaitable, ec));
 
-                if (it != m_clients.cend()) {
-                    m_clients.erase(it);
+                if (ec.failed()) {
+                    fail_write(*cl);
+                    throw boost::system::system_error(ec);
                 }
+
+                continue_writing(*cl);
             }
 
-            void send(client& a_client) {
-                boost::asio::write(a_client.m_socket, boost::asio::buffer(get_buffer()));
+            awaitable<std::shared_ptr<client>> co_accept() {
+                m_coroutine_accept = true;
+                return m_accepted.pop();
             }
+#endif
 
         private:
             void begin_accept() {
                 m_acceptor->async_accept([this](error_code a_ec, socket a_socket) {
-                    m_clients.push_back(std::make_unique<client>(std::move(a_socket), m_id_counter++));
+                    if (!m_acceptor->is_open()) {
+                        return;
+                    }
+
                     begin_accept();
-                    client& cl = *m_clients.back();
-                    begin_accept_message(cl);
-                    dispatch_connect(cl);
 
-                    compile_schema();
-                    send(cl);
+                    if (a_ec.failed()) {
+                        return;
+                    }
+
+                    add_client(std::move(a_socket));
+                });
+            }
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+            void begin_accept_local() {
+                m_local_acceptor->async_accept([this](error_code a_ec, local_socket a_socket) {
+                    if (!m_local_acceptor->is_open()) {
+                        return;
+                    }
+
+                    begin_accept_local();
+
+                    if (a_ec.failed()) {
+                        return;
+                    }
+
+                    if (!m_shared_memory) {
+                        add_client(std::move(a_socket));
+                        return;
+                    }
+
+                    try {
+                        add_client(shm_stream::create(std::move(a_socket)));
+                    } catch (const std::exception&) {
+                        // Could not set up the segment; dropping the socket closes the connection.
+                    }
                 });
             }
+#endif
+
+            void add_client(transport a_transport) {
+                m_clients.push_back(std::make_shared<client>(std::move(a_transport), m_id_counter++));
+                client& cl = *m_clients.back();
+                cl.m_net = this;
+
+#if defined(SR_NET_IO_URING)
+                if (m_receive_pool) {
+                    cl.m_pool = m_receive_pool;
+                    cl.m_slot = m_receive_pool->acquire();
+                }
+
+                if (cl.m_slot == registered_buffer_pool::npos) {
+                    cl.m_receive_buffer.resize(get_buffer().size());
+                }
+#else
+                cl.m_receive_buffer.resize(get_buffer().size());
+#endif
+                cl.m_capture = m_capture;
+                begin_accept_message(cl);
+                dispatch_connect(cl);
+
+                compile_schema();
+                send(cl);
+            }
 
             void begin_accept_message(client& a_client) {
-                a_client.m_socket.async_read_some(
-                    boost::asio::buffer(get_buffer()),
-                    [this, &a_client](boost::system::error_code a_ec, std::size_t a_bytes_transferred) {
-                        if (a_ec == boost::asio::error::connection_reset) {
-                            // Detected client disconnect.
+                boost::asio::async_read(
+                    a_client.m_socket,
+                    boost::asio::buffer(&a_client.m_frame_size, sizeof(frame_size)),
+                    [this, cl = a_client.shared_from_this()](boost::system::error_code a_ec, std::size_t) {
+                        if (a_ec.failed() || cl->m_frame_size < sizeof(size_t) || cl->m_frame_size > get_buffer().size()) {
+                            // Detected client disconnect or a malformed frame.
+
+                            disconnect(*cl);
+                            return;
+                        }
 
-                            disconnect(a_client);
+                        // Oversized frames always disconnect; reading them would spend what the limit is there to save.
+                        if (m_admission.m_max_frame_size != 0 && cl->m_frame_size > m_admission.m_max_frame_size) {
+                            ++cl->m_rejected;
+                            ++m_rejected;
+
+                            disconnect(*cl);
+                            return;
+                        }
+
+                        accept_frame(*cl);
+                    }
+                );
+            }
+
+            void accept_frame(client& a_client) {
+#if defined(SR_NET_IO_URING)
+                if (a_client.m_slot != registered_buffer_pool::npos) {
+                    read_frame(a_client, boost::asio::buffer(a_client.m_pool->at(a_client.m_slot), a_client.m_frame_size));
+                    return;
+                }
+#endif
+
+                read_frame(a_client, boost::asio::buffer(a_client.m_receive_buffer.data(), a_client.m_frame_size));
+            }
+
+            template <typename t_buffer>
+            void read_frame(client& a_client, const t_buffer& a_buffer) {
+                boost::asio::async_read(
+                    a_client.m_socket,
+                    a_buffer,
+                    [this, cl = a_client.shared_from_this()](boost::system::error_code a_ec, std::size_t a_bytes_transferred) {
+                        if (a_ec.failed()) {
+                            disconnect(*cl);
+                            return;
+                        }
+
+                        std::chrono::nanoseconds pause(0);
+
+                        if (!admit(*cl, a_bytes_transferred, pause)) {
+                            ++cl->m_rejected;
+                            ++m_rejected;
+
+                            if (m_admission.m_policy == limit_policy::disconnect) {
+                                disconnect(*cl);
+                            } else {
+                                begin_accept_message(*cl);
+                            }
+
+                            return;
+                        }
+
+                        if (m_capture) {
+                            m_capture->append(capture_direction::received, cl->m_id, cl->get_receive_data(), a_bytes_transferred);
+                        }
+
+                        std::memcpy(get_buffer().data(), cl->get_receive_data(), a_bytes_transferred);
+                        handle_frame(*cl, a_bytes_transferred);
+
+                        // The handler may have disconnected the client.
+                        if (!cl->m_socket.is_open()) {
                             return;
                         }
 
-                        if (!a_ec.failed()) {
-                            dispatch(a_client);
+                        if (pause.count() > 0) {
+                            resume_after(*cl, pause);
+                        } else {
+                            begin_accept_message(*cl);
+                        }
+                    }
+                );
+            }
+
+            /// Charge a received frame to the client's budgets. Returns false if it must be rejected. Otherwise a_pause
+            /// is set to how long reading should stop for the client to get back within its limits.
+            bool admit(client& a_client, size_t a_size, std::chrono::nanoseconds& a_pause) {
+                size_t id;
+                std::memcpy(&id, a_client.get_receive_data(), sizeof(id));
+
+                const rate_limit* id_limit = nullptr;
+                token_bucket* id_bucket = nullptr;
+
+                if (!m_id_limits.empty()) {
+                    auto it = m_id_limits.find(id);
+
+                    if (it != m_id_limits.cend() && it->second.is_limited()) {
+                        id_limit = &it->second;
+                        id_bucket = &a_client.m_id_buckets[id];
+                    }
+                }
+
+                auto& messages = m_admission.m_messages;
+                auto& bytes = m_admission.m_bytes;
+
+                if (!messages.is_limited() && !bytes.is_limited() && !id_limit) {
+                    return true;
+                }
+
+                auto now = std::chrono::steady_clock::now();
+                auto size = static_cast<double>(a_size);
+
+                if (messages.is_limited()) {
+                    a_client.m_message_bucket.refill(messages, now);
+                }
+
+                if (bytes.is_limited()) {
+                    a_client.m_byte_bucket.refill(bytes, now);
+                }
+
+                if (id_limit) {
+                    id_bucket->refill(*id_limit, now);
+                }
+
+                if (m_admission.m_policy != limit_policy::throttle) {
+                    bool within = (!messages.is_limited() || a_client.m_message_bucket.available(1))
+                               && (!bytes.is_limited() || a_client.m_byte_bucket.available(size))
+                               && (!id_limit || id_bucket->available(1));
+
+                    // Control frames such as NET_SIGNAL_READY and NET_SUBSCRIBE are charged but never dropped, since
+                    // losing one would leave the session half set up. Over the limit they pause reading instead.
+                    if (!within && !(m_admission.m_policy == limit_policy::drop && is_builtin_id(id))) {
+                        return false;
+                    }
+                }
+
+                if (messages.is_limited()) {
+                    a_pause = std::max(a_pause, a_client.m_message_bucket.take(messages, 1));
+                }
+
+                if (bytes.is_limited()) {
+                    a_pause = std::max(a_pause, a_client.m_byte_bucket.take(bytes, size));
+                }
+
+                if (id_limit) {
+                    a_pause = std::max(a_pause, id_bucket->take(*id_limit, 1));
+                }
+
+                return true;
+            }
+
+            /// Stop reading from a client for a while. Its socket buffer fills and TCP pushes back on the sender.
+            void resume_after(client& a_client, std::chrono::nanoseconds a_pause) {
+                ++a_client.m_throttled;
+                ++m_throttled;
+
+                if (!a_client.m_resume) {
+                    a_client.m_resume.emplace(m_context);
+                }
+
+                a_client.m_resume->expires_after(a_pause);
+                a_client.m_resume->async_wait([this, cl = a_client.shared_from_this()](error_code a_ec) {
+                    if (!a_ec.failed() && cl->m_socket.is_open()) {
+                        begin_accept_message(*cl);
+                    }
+                });
+            }
+
+            /// Run the handler for the frame in the buffer.
+            void handle_frame(client& a_client, size_t a_size) {
+                if (auto* handler = find_offload_handler()) {
+                    offload(a_client, *handler, a_size);
+                } else if (!deliver_to_coroutine(a_client, a_size)) {
+                    dispatch(a_client);
+                }
+            }
+
+            /// Announce a stream body of a_length bytes that follows the frame directly on the socket.
+            void send_stream_header(client& a_client, std::string_view a_id, uint64_t a_length) {
+                auto header = create_message("NET_STREAM");
+                header.write_string(a_id);
+                header.write_int(a_length);
+                send(a_client, header);
+            }
+
+            size_t publish_frame(const std::string& a_topic, const uint8_t* a_data, size_t a_size) {
+                auto topic = m_topics.find(a_topic);
+
+                if (topic == m_topics.cend()) {
+                    return 0;
+                }
+
+                std::vector<std::shared_ptr<client>> failed;
+
+                for (auto& subscriber : topic->second) {
+                    try {
+                        send_frame(*subscriber, a_data, a_size);
+                    } catch (const boost::system::system_error&) {
+                        failed.push_back(subscriber);
+                    }
+                }
+
+                size_t sent = topic->second.size() - failed.size();
+
+                // Disconnecting unsubscribes, so wait until the subscriber list is no longer being walked.
+                for (auto& subscriber : failed) {
+                    disconnect(*subscriber);
+                }
+
+                return sent;
+            }
+
+            void queue_latest(client& a_client, uint64_t a_key, const uint8_t* a_data, size_t a_size) {
+                if (m_replaying || !a_client.m_socket.is_open()) {
+                    return;
+                }
+
+                size_t id;
+                std::memcpy(&id, a_data, sizeof(id));
+
+                auto [it, inserted] = a_client.m_conflated_index.try_emplace({ id, a_key }, a_client.m_conflated.size());
+
+                if (inserted) {
+                    a_client.m_conflated.emplace_back(a_data, a_data + a_size);
+                } else {
+                    a_client.m_conflated[it->second].assign(a_data, a_data + a_size);
+                }
+
+                // A write in flight picks up the new value when it completes.
+                if (a_client.m_writing || a_client.m_awaiting_writable) {
+                    return;
+                }
+
+                a_client.m_awaiting_writable = true;
+                a_client.m_socket.async_wait(socket::wait_write, [this, cl = a_client.shared_from_this()](error_code a_ec) {
+                    cl->m_awaiting_writable = false;
+
+                    // A stream body may have taken the socket meanwhile; it writes the batch when it finishes.
+                    if (!a_ec.failed() && cl->m_socket.is_open() && !cl->m_writing) {
+                        continue_writing(*cl);
+                    }
+                });
+            }
+
+            /// Start the client's next async write: a deferred stream body, or the deferred frames and every pending
+            /// conflated frame in one gathered write. Until it completes, other sends to the client are deferred
+            /// and new conflated values wait for the next batch.
+            void continue_writing(client& a_client) {
+                a_client.m_writing = false;
+                a_client.m_in_flight.clear();
+
+                if (!a_client.m_deferred.empty() && a_client.m_deferred.front().m_start) {
+                    auto start = std::move(a_client.m_deferred.front().m_start);
+                    a_client.m_deferred.pop_front();
+
+                    a_client.m_writing = true;
+                    start(a_client.shared_from_this());
+                    return;
+                }
+
+                while (!a_client.m_deferred.empty() && !a_client.m_deferred.front().m_start) {
+                    a_client.m_in_flight.push_back(std::move(a_client.m_deferred.front().m_frame));
+                    a_client.m_deferred.pop_front();
+                }
+
+                // Conflated frames are not ordered against other sends, but must not come between a stream header
+                // and its body.
+                if (a_client.m_deferred.empty()) {
+                    for (auto& frame : a_client.m_conflated) {
+                        if (m_capture) {
+                            m_capture->append(capture_direction::sent, a_client.m_id, frame.data(), frame.size());
                         }
 
-                        begin_accept_message(a_client);
+                        a_client.m_in_flight.push_back(std::move(frame));
+                    }
+
+                    a_client.m_conflated.clear();
+                    a_client.m_conflated_index.clear();
+                }
+
+                if (a_client.m_in_flight.empty()) {
+                    return;
+                }
+
+                std::vector<boost::asio::const_buffer> buffers;
+                buffers.reserve(a_client.m_in_flight.size() * 2);
+
+                // Reserved up front, since the buffers point into it.
+                a_client.m_in_flight_sizes.clear();
+                a_client.m_in_flight_sizes.reserve(a_client.m_in_flight.size());
+
+                for (auto& frame : a_client.m_in_flight) {
+                    a_client.m_in_flight_sizes.push_back(static_cast<frame_size>(frame.size()));
+                    buffers.push_back(boost::asio::buffer(&a_client.m_in_flight_sizes.back(), sizeof(frame_size)));
+                    buffers.push_back(boost::asio::buffer(frame));
+                }
+
+                a_client.m_writing = true;
+                boost::asio::async_write(a_client.m_socket, buffers, [this, cl = a_client.shared_from_this()](error_code a_ec, size_t) {
+                    if (a_ec.failed()) {
+                        fail_write(*cl);
+                        return;
+                    }
+
+                    continue_writing(*cl);
+                });
+            }
+
+            /// Drop everything still to be written and disconnect the client. A partly written frame or stream body
+            /// leaves the other side unable to find the next frame.
+            void fail_write(client& a_client) {
+                a_client.m_writing = false;
+                a_client.m_in_flight.clear();
+                a_client.m_deferred.clear();
+                a_client.m_conflated.clear();
+                a_client.m_conflated_index.clear();
+
+                disconnect(a_client);
+            }
+
+            /// Keep a copy of a frame to send after the client's async write, so the two do not interleave.
+            static void defer_frame(client& a_client, const uint8_t* a_data, size_t a_size) {
+                a_client.m_deferred.push_back({ std::vector<uint8_t>(a_data, a_data + a_size), {} });
+            }
+
+            /// Start writing a stream body now if nothing else is being written to the client, or after what is.
+            /// a_start must end in continue_writing() or fail_write().
+            void write_body(client& a_client, std::function<void (const std::shared_ptr<client>&)> a_start) {
+                if (a_client.m_writing) {
+                    a_client.m_deferred.push_back({ {}, std::move(a_start) });
+                    return;
+                }
+
+                a_client.m_writing = true;
+                a_start(a_client.shared_from_this());
+            }
+
+            void send_frame(client& a_client, const uint8_t* a_data, size_t a_size) {
+                if (m_replaying) {
+                    return;
+                }
+
+                if (m_capture) {
+                    m_capture->append(capture_direction::sent, a_client.m_id, a_data, a_size);
+                }
+
+                if (a_client.m_writing) {
+                    defer_frame(a_client, a_data, a_size);
+                    return;
+                }
+
+                write_frame(a_client.m_socket, a_data, a_size);
+            }
+
+            void offload(client& a_client, offload_handler& a_handler, size_t a_size) {
+                if (!m_workers) {
+                    m_workers = std::make_unique<worker_pool>(std::max(1u, std::thread::hardware_concurrency()));
+                }
+
+                if (!a_client.m_serial) {
+                    a_client.m_serial.emplace(m_workers->make_serial_queue());
+                }
+
+                boost::asio::post(
+                    *a_client.m_serial,
+                    [&a_handler, cl = a_client.shared_from_this(), msg = message(get_buffer().data(), a_size)]() mutable {
+                        msg.read_id();
+                        a_handler(msg, *cl);
                     }
                 );
             }
 
+            /// Hand an unhandled message to a coroutine waiting in client::co_next_message().
+            bool deliver_to_coroutine(client& a_client, size_t a_size) {
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+                if (a_client.m_coroutine && !is_handled()) {
+                    message msg(get_buffer().data(), a_size);
+                    msg.read_id();
+                    a_client.m_inbox.push(std::move(msg));
+                    return true;
+                }
+#else
+                static_cast<void>(a_client);
+                static_cast<void>(a_size);
+#endif
+
+                return false;
+            }
+
+            /// Post one flush for any number of queued messages made before it runs.
+            void schedule_flush() {
+                if (!m_flush_scheduled.exchange(true)) {
+                    boost::asio::post(m_context, [this]() {
+                        m_flush_scheduled = false;
+                        flush_outbound();
+                    });
+                }
+            }
+
+            /// Send everything queued by other threads, with one gathered write per client.
+            void flush_outbound() {
+                outbound_message entry;
+
+                while (m_outbound.pop(entry)) {
+                    m_flush_messages.push_back(std::move(entry));
+                }
+
+                if (m_flush_messages.empty()) {
+                    return;
+                }
+
+                for (auto& queued : m_flush_messages) {
+                    if (queued.m_client) {
+                        m_flush_batch.emplace_back(queued.m_client.get(), &queued.m_message);
+                    } else if (queued.m_topic.empty()) {
+                        for (auto& cl : m_clients) {
+                            m_flush_batch.emplace_back(cl.get(), &queued.m_message);
+                        }
+                    } else if (auto topic = m_topics.find(queued.m_topic); topic != m_topics.cend()) {
+                        for (auto& subscriber : topic->second) {
+                            m_flush_batch.emplace_back(subscriber.get(), &queued.m_message);
+                        }
+                    }
+                }
+
+                // Group by client while keeping each client's messages in order.
+                std::stable_sort(m_flush_batch.begin(), m_flush_batch.end(), [](const auto& a_lhs, const auto& a_rhs) {
+                    return a_lhs.first < a_rhs.first;
+                });
+
+                std::vector<const message*> messages;
+
+                for (auto begin = m_flush_batch.begin(); begin != m_flush_batch.end();) {
+                    auto end = std::find_if(begin, m_flush_batch.end(), [&begin](const auto& a_entry) {
+                        return a_entry.first != begin->first;
+                    });
+
+                    client& cl = *begin->first;
+
+                    // Skip replies for clients that disconnected while their handler ran.
+                    if (cl.m_socket.is_open() && !m_replaying) {
+                        messages.clear();
+
+                        for (auto it = begin; it != end; ++it) {
+                            if (m_capture) {
+                                m_capture->append(capture_direction::sent, cl.m_id, it->second->get_buffer().data(), it->second->get_size());
+                            }
+
+                            if (cl.m_writing) {
+                                defer_frame(cl, it->second->get_buffer().data(), it->second->get_size());
+                            } else {
+                                messages.push_back(it->second);
+                            }
+                        }
+
+                        error_code ec;
+                        write_frames(cl.m_socket, messages, ec);
+
+                        if (ec.failed()) {
+                            fail_write(cl);
+                        }
+                    }
+
+                    begin = end;
+                }
+
+                m_flush_batch.clear();
+                m_flush_messages.clear();
+            }
+
+            /// Sleeps while there is nothing to do; queued sends and stop_async() post work to wake it.
             void run() {
+                auto work = boost::asio::make_work_guard(m_context);
+
                 while (m_running) {
-                    m_context.poll_one();
+                    m_context.run_one();
                 }
             }
         };
+
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+        inline awaitable<void> client::co_send(message a_message) {
+            co_await m_net->co_send(*this, std::move(a_message));
+        }
+#endif
     }
 }
 
@@ -0,0 +1,89 @@
+#include <iostream>
+#include <net.hpp>
+
+// Loopback check that offloaded handlers run away from the io thread and still see each client's
+// messages in the order they were sent.
+
+constexpr size_t clients = 4;
+constexpr size_t messages_per_client = 1000;
+
+int main() {
+    sr::server::net server;
+    server.open(2017);
+
+    server.add_network_string("Sequence");
+    server.set_worker_threads(4);
+
+    std::thread::id io_thread;
+    std::mutex guard;
+    std::map<const sr::server::client*, size_t> expected;
+    std::atomic<size_t> handled = 0;
+    std::atomic<size_t> out_of_order = 0;
+    std::atomic<size_t> on_io_thread = 0;
+
+    server.on_connect([&](auto& client) {
+        std::lock_guard lock(guard);
+        io_thread = std::this_thread::get_id();
+        expected[&client] = 0;
+    });
+
+    server.receive_offload("Sequence", [&](sr::message& msg, auto& client) {
+        auto sequence = static_cast<size_t>(msg.read_int());
+
+        {
+            std::lock_guard lock(guard);
+
+            if (std::this_thread::get_id() == io_thread) {
+                ++on_io_thread;
+            }
+
+            if (expected[&client]++ != sequence) {
+                ++out_of_order;
+            }
+        }
+
+        ++handled;
+    });
+
+    server.start_async();
+
+    std::vector<std::unique_ptr<sr::client::net>> nets;
+
+    for (size_t i = 0; i < clients; ++i) {
+        auto& net = *nets.emplace_back(std::make_unique<sr::client::net>());
+        std::promise<void> ready;
+
+        net.on_ready([&ready]() {
+            ready.set_value();
+        });
+
+        net.connect("localhost", 2017);
+        net.start_async();
+        ready.get_future().wait();
+    }
+
+    for (size_t sequence = 0; sequence < messages_per_client; ++sequence) {
+        for (auto& net : nets) {
+            auto msg = net->create_message("Sequence");
+            msg.write_int(sequence);
+            net->queue_send(std::move(msg));
+        }
+    }
+
+    for (size_t i = 0; i < 500 && handled < clients * messages_per_client; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    for (auto& net : nets) {
+        net->stop_async();
+    }
+
+    server.stop_async();
+
+    std::cout << "handled " << handled << ", out of order " << out_of_order << ", on io thread " << on_io_thread << std::endl;
+
+    bool passed = handled == clients * messages_per_client && out_of_order == 0 && on_io_thread == 0;
+    std::cout << (passed ? "passed" : "FAILED") << std::endl;
+
+    return passed ? 0 : 1;
+}
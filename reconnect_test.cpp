@@ -0,0 +1,81 @@
+#include <iostream>
+#include <net.hpp>
+
+// Loopback check of async_connect(): a refused connection reports its error, and a client with
+// reconnect enabled finds its server again after the server restarts.
+
+template <typename t_predicate>
+bool wait_for(t_predicate a_predicate, std::chrono::milliseconds a_timeout = std::chrono::seconds(3)) {
+    auto deadline = std::chrono::steady_clock::now() + a_timeout;
+
+    while (!a_predicate()) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    return true;
+}
+
+int main() {
+    sr::client::net refused;
+    std::atomic<bool> refused_done = false;
+    std::atomic<bool> refused_failed = false;
+
+    refused.start_async();
+    refused.async_connect("127.0.0.1", 2025, [&](sr::error_code a_ec) {
+        refused_failed = a_ec.failed();
+        refused_done = true;
+    });
+
+    wait_for([&]() { return refused_done.load(); });
+    refused.stop_async();
+
+    auto server = std::make_unique<sr::server::net>();
+    server->open(2026);
+    server->start_async();
+
+    sr::client::net net;
+    std::atomic<size_t> ready = 0;
+    std::atomic<size_t> disconnects = 0;
+
+    net.on_ready([&ready]() {
+        ++ready;
+    });
+
+    net.on_disconnect([&disconnects]() {
+        ++disconnects;
+    });
+
+    net.enable_reconnect(std::chrono::milliseconds(50), std::chrono::milliseconds(400));
+    net.start_async();
+    net.async_connect("localhost", 2026);
+
+    bool first = wait_for([&]() { return ready == 1; });
+
+    server->stop_async();
+    server.reset();
+
+    bool lost = wait_for([&]() { return disconnects == 1; });
+
+    // Let a few reconnect attempts fail before the server comes back.
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    server = std::make_unique<sr::server::net>();
+    server->open(2026);
+    server->start_async();
+
+    bool second = wait_for([&]() { return ready == 2; });
+
+    net.stop_async();
+    server->stop_async();
+
+    std::cout << "refused " << refused_failed << ", first " << first << ", lost " << lost << ", reconnected " << second << std::endl;
+
+    bool passed = refused_failed && first && lost && second;
+    std::cout << (passed ? "passed" : "FAILED") << std::endl;
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,104 @@
+#include <iostream>
+#include <net.hpp>
+
+// Loopback check that a captured session replays through the same handlers without sockets, that
+// subscriptions made by replayed clients do not stay behind, and that pacing survives a record stamped
+// earlier than the first.
+
+constexpr size_t message_count = 10;
+
+/// Stamp the last record at time zero, as a capture taken while the system clock stepped back would be.
+void step_clock_back(const std::string& a_path) {
+    std::fstream file(a_path, std::ios::in | std::ios::out | std::ios::binary);
+
+    sr::capture_header header {};
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+    sr::capture_record record {};
+    size_t last = 0;
+
+    for (size_t offset = sizeof(header); offset + sizeof(record) <= header.m_end; offset += sizeof(record) + record.m_size) {
+        file.seekg(static_cast<std::streamoff>(offset));
+        file.read(reinterpret_cast<char*>(&record), sizeof(record));
+        last = offset;
+    }
+
+    record.m_time = 0;
+    file.seekp(static_cast<std::streamoff>(last));
+    file.write(reinterpret_cast<const char*>(&record), sizeof(record));
+}
+
+int main() {
+    auto path = (std::filesystem::temp_directory_path() / "sr-replay-test.cap").string();
+    std::atomic<size_t> live_sum = 0;
+
+    {
+        sr::server::net server;
+        server.open(2019);
+
+        server.add_network_string("Add");
+
+        server.receive("Add", [&](auto& client) {
+            live_sum += server.read_int();
+        });
+
+        server.start_capture(path);
+        server.start_async();
+
+        sr::client::net net;
+        std::promise<void> ready;
+
+        net.on_ready([&]() {
+            net.subscribe("totals");
+            ready.set_value();
+        });
+
+        net.connect("localhost", 2019);
+        net.start_async();
+        ready.get_future().wait();
+
+        for (size_t i = 1; i <= message_count; ++i) {
+            auto msg = net.create_message("Add");
+            msg.write_int(i);
+            net.queue_send(std::move(msg));
+        }
+
+        for (size_t i = 0; i < 300 && live_sum < message_count * (message_count + 1) / 2; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        net.stop_async();
+        server.stop_async();
+        server.stop_capture();
+    }
+
+    sr::server::net replayer;
+    replayer.add_network_string("Add");
+
+    size_t replayed_sum = 0;
+
+    replayer.receive("Add", [&](auto& client) {
+        replayed_sum += replayer.read_int();
+    });
+
+    // Every Add, plus the client's NET_SIGNAL_READY and NET_SUBSCRIBE.
+    auto frames = replayer.replay(path);
+
+    step_clock_back(path);
+
+    auto paced_start = std::chrono::steady_clock::now();
+    auto paced_frames = replayer.replay(path, true);
+    auto paced_time = std::chrono::steady_clock::now() - paced_start;
+
+    std::filesystem::remove(path);
+
+    std::cout << "live " << live_sum << ", replayed " << replayed_sum << " from " << frames << " frames, "
+              << replayer.subscriber_count("totals") << " subscribers left, paced replay of " << paced_frames << " frames took "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(paced_time).count() << " ms" << std::endl;
+
+    bool passed = live_sum * 2 == replayed_sum && frames == message_count + 2 && replayer.subscriber_count("totals") == 0
+               && paced_frames == frames && paced_time < std::chrono::seconds(5);
+    std::cout << (passed ? "passed" : "FAILED") << std::endl;
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,86 @@
+#include <iostream>
+#include <net.hpp>
+
+// Loopback check that pipelined calls are matched to their responses when the server answers them
+// out of order, and that an unanswered call times out.
+
+constexpr size_t call_count = 8;
+
+int main() {
+    sr::server::net server;
+    server.open(2018);
+
+    server.add_network_string("Square");
+    server.add_network_string("Ignored");
+
+    std::vector<std::pair<uint32_t, size_t>> requests;
+
+    // Hold the requests until all have arrived, then answer the newest first.
+    server.receive("Square", [&](auto& client) {
+        auto call_id = server.read_call_id();
+        requests.emplace_back(call_id, server.read_int());
+
+        if (requests.size() < call_count) {
+            return;
+        }
+
+        for (auto it = requests.rbegin(); it != requests.rend(); ++it) {
+            auto reply = server.create_reply(it->first);
+            reply.write_int(it->second * it->second);
+            server.send(client, reply);
+        }
+
+        requests.clear();
+    });
+
+    server.receive("Ignored", [](auto& client) {});
+
+    server.start_async();
+
+    sr::client::net net;
+    std::promise<void> ready;
+
+    net.on_ready([&ready]() {
+        ready.set_value();
+    });
+
+    net.connect("localhost", 2018);
+    net.start_async();
+    ready.get_future().wait();
+
+    std::vector<sr::rpc_call> calls;
+
+    for (size_t i = 0; i < call_count; ++i) {
+        calls.push_back(net.call("Square", i + 1));
+    }
+
+    size_t matched = 0;
+
+    for (size_t i = 0; i < call_count; ++i) {
+        auto response = calls[i].get();
+
+        if (response.read_int() == (i + 1) * (i + 1)) {
+            ++matched;
+        }
+    }
+
+    net.set_call_timeout(std::chrono::milliseconds(100));
+
+    bool timed_out = false;
+
+    try {
+        static_cast<void>(net.call("Ignored").get());
+    } catch (const boost::system::system_error& e) {
+        timed_out = e.code() == boost::asio::error::timed_out;
+    }
+
+    net.stop_async();
+    server.stop_async();
+
+    std::cout << "matched " << matched << " of " << call_count << ", timed out " << timed_out << std::endl;
+
+    bool passed = matched == call_count && timed_out;
+    std::cout << (passed ? "passed" : "FAILED") << std::endl;
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,109 @@
+#include <iostream>
+#include <net.hpp>
+
+// Loopback check of file and mapped-region streaming into a buffer sink and a file sink, including empty
+// bodies, with ordinary messages sent after the streams arriving intact.
+
+constexpr size_t file_size = 100 * 1024;
+constexpr size_t message_count = 50;
+
+int main() {
+    auto directory = std::filesystem::temp_directory_path();
+    auto empty_path = (directory / "sr-stream-test-empty.bin").string();
+    auto source_path = (directory / "sr-stream-test-source.bin").string();
+    auto saved_path = (directory / "sr-stream-test-saved.bin").string();
+    auto saved_empty_path = (directory / "sr-stream-test-saved-empty.bin").string();
+
+    std::vector<char> source(file_size);
+
+    for (size_t i = 0; i < source.size(); ++i) {
+        source[i] = static_cast<char>(i * 7);
+    }
+
+    std::ofstream(empty_path, std::ios::binary);
+    std::ofstream(source_path, std::ios::binary).write(source.data(), static_cast<std::streamsize>(source.size()));
+
+    sr::server::net server;
+    server.open(2027);
+
+    server.add_network_string("Asset");
+    server.add_network_string("Save");
+    server.add_network_string("After");
+
+    server.on_ready([&](auto& client) {
+        server.send_file(client, "Asset", empty_path);
+        server.send_file(client, "Asset", source_path);
+        server.send_file(client, "Save", source_path);
+        server.send_file(client, "Save", empty_path);
+
+        boost::interprocess::file_mapping mapping(source_path.c_str(), boost::interprocess::read_only);
+        server.send_mapped(client, "Asset", std::make_shared<boost::interprocess::mapped_region>(mapping, boost::interprocess::read_only));
+
+        for (size_t i = 0; i < message_count; ++i) {
+            server.start("After");
+            server.write_int(i);
+            server.send(client);
+        }
+    });
+
+    server.start_async();
+
+    sr::client::net net;
+    std::vector<std::vector<char>> buffers;
+    size_t saved = 0;
+    size_t failed = 0;
+    std::atomic<size_t> after = 0;
+    std::atomic<size_t> out_of_order = 0;
+
+    net.receive_stream("Asset", [&](uint64_t a_length) -> sr::stream_sink {
+        auto& buffer = buffers.emplace_back(a_length);
+        return { buffer.data(), "" };
+    }, [&](const sr::stream_sink&, sr::error_code a_ec) {
+        failed += a_ec.failed();
+    });
+
+    net.receive_stream("Save", [&](uint64_t) -> sr::stream_sink {
+        return { nullptr, saved++ == 0 ? saved_path : saved_empty_path };
+    }, [&](const sr::stream_sink&, sr::error_code a_ec) {
+        failed += a_ec.failed();
+    });
+
+    net.receive("After", [&]() {
+        if (net.read_int() != after) {
+            ++out_of_order;
+        }
+
+        ++after;
+    });
+
+    net.connect("localhost", 2027);
+    net.start_async();
+
+    for (size_t i = 0; i < 300 && after < message_count; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    net.stop_async();
+    server.stop_async();
+
+    std::ifstream saved_file(saved_path, std::ios::binary);
+    std::vector<char> saved_contents((std::istreambuf_iterator<char>(saved_file)), std::istreambuf_iterator<char>());
+
+    bool buffers_match = buffers.size() == 3 && buffers[0].empty() && buffers[1] == source && buffers[2] == source;
+    bool files_match = saved == 2 && saved_contents == source && std::filesystem::exists(saved_empty_path) && std::filesystem::file_size(saved_empty_path) == 0;
+
+    saved_file.close();
+
+    for (auto& path : { empty_path, source_path, saved_path, saved_empty_path }) {
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+    }
+
+    std::cout << "buffers " << buffers_match << ", files " << files_match << ", failed " << failed
+              << ", after " << after << ", out of order " << out_of_order << std::endl;
+
+    bool passed = buffers_match && files_match && failed == 0 && after == message_count && out_of_order == 0;
+    std::cout << (passed ? "passed" : "FAILED") << std::endl;
+
+    return passed ? 0 : 1;
+}